@@ -2,9 +2,41 @@
 //
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <concepts>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <list>
 #include <locale>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <string_view>
 #include <tuple>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "sqlite3.h"
@@ -74,145 +106,3701 @@ bool initialize_database(sqlite3* db)
 }
 
 /**
- * Parses the left operand of an expression within a string `str`, where the operator is at index `i` of the string
+ * Severity of a log line. Lines below SQLI_MIN_LOG_LEVEL are compiled out. The default of 1 drops the per-query trace
+ * lines, which are for debugging: build with -DSQLI_MIN_LOG_LEVEL=0 to keep them, or higher to keep only warnings and
+ * errors.
  */
-std::string parse_left_operand(std::string str, size_t i) {
-    size_t substr_len = 0;
-    size_t cur = i;
-    while (cur > 0 && str[cur--] != ' ') substr_len++;
-    return str.substr(cur + 2, substr_len - 1);
+enum class log_level { trace, info, warn, error };
+
+#ifndef SQLI_MIN_LOG_LEVEL
+#define SQLI_MIN_LOG_LEVEL 1
+#endif
+
+constexpr log_level minimum_log_level = static_cast<log_level>(SQLI_MIN_LOG_LEVEL);
+
+/**
+ * Asynchronous line logger. Callers format straight into a fixed size slot of a bounded lock-free ring (Dmitry Vyukov's
+ * MPMC queue, used here with many producers and one consumer) and return without touching the sink; a background
+ * writer thread drains whatever has queued up into one buffer and writes it with a single fwrite and fflush. When the
+ * ring is full the caller drops the oldest line instead of waiting; if the oldest line is still being written by another
+ * caller, it gives up after a few tries and drops its own line. The number of dropped lines is counted. Lines longer
+ * than a slot are truncated.
+ */
+class async_logger {
+public:
+    explicit async_logger(FILE* sink, size_t capacity = 4096) : sink(sink), mask(round_up_to_power_of_two(capacity) - 1),
+        slots(new slot[mask + 1]) {
+        for (size_t i = 0; i <= mask; ++i) slots[i].sequence.store(i, std::memory_order_relaxed);
+        writer = std::thread([this]() { run_writer(); });
+    }
+
+    ~async_logger() {
+        stopping.store(true);
+        wake_writer();
+        writer.join();
+    }
+
+    async_logger(const async_logger&) = delete;
+    async_logger& operator=(const async_logger&) = delete;
+
+    /**
+     * Queues one line made of `parts` (strings, characters and numbers) at `level`. Never blocks on the sink.
+     */
+    template <typename... Parts>
+    void write(log_level level, const Parts&... parts) {
+        slot* claimed;
+        size_t position = enqueue_position.load(std::memory_order_relaxed);
+        int attempts_left = 16;
+        for (;;) {
+            claimed = &slots[position & mask];
+            const size_t sequence = claimed->sequence.load(std::memory_order_acquire);
+            const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+            if (difference == 0) {
+                if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+            }
+            else if (difference < 0) {
+                // full: make room by throwing away the oldest line, then try again
+                if (discard_oldest()) {
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                }
+                else if (--attempts_left == 0) {
+                    // the oldest line is claimed but not yet published, so drop this one rather than spin
+                    rejected.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                position = enqueue_position.load(std::memory_order_relaxed);
+            }
+            else {
+                position = enqueue_position.load(std::memory_order_relaxed);
+            }
+        }
+
+        char* out = claimed->text;
+        char* const end = claimed->text + sizeof(claimed->text);
+        (append(out, end, parts), ...);
+        claimed->level = level;
+        claimed->length = static_cast<uint16_t>(out - claimed->text);
+        claimed->sequence.store(position + 1, std::memory_order_release);
+        wake_writer();
+    }
+
+    /**
+     * Waits until every line queued before the call has been written to the sink or dropped.
+     */
+    void flush() {
+        const size_t target = enqueue_position.load();
+        wake_writer();
+        while (flushed_position.load() < target) std::this_thread::yield();
+    }
+
+    /**
+     * Number of lines thrown away because the ring was full.
+     */
+    size_t dropped_lines() const { return dropped.load(std::memory_order_relaxed) + rejected.load(std::memory_order_relaxed); }
+
+private:
+    struct slot {
+        std::atomic<size_t> sequence;
+        log_level level;
+        uint16_t length;
+        char text[240];
+    };
+
+    static size_t round_up_to_power_of_two(size_t value) {
+        size_t power = 2;
+        while (power < value) power <<= 1;
+        return power;
+    }
+
+    static void append(char*& out, char* end, std::string_view text) {
+        const size_t count = std::min(text.size(), static_cast<size_t>(end - out));
+        std::memcpy(out, text.data(), count);
+        out += count;
+    }
+
+    static void append(char*& out, char* end, const char* text) { append(out, end, std::string_view(text)); }
+    static void append(char*& out, char* end, const std::string& text) { append(out, end, std::string_view(text)); }
+
+    static void append(char*& out, char* end, char c) {
+        if (out != end) *out++ = c;
+    }
+
+    template <typename Number>
+        requires std::is_arithmetic_v<Number>
+    static void append(char*& out, char* end, Number value) {
+        const auto result = std::to_chars(out, end, value);
+        if (result.ec == std::errc()) out = result.ptr;
+    }
+
+    // takes the oldest line off the ring; false if another thread got to it first or it is still being written
+    bool discard_oldest() {
+        size_t position = dequeue_position.load(std::memory_order_relaxed);
+        slot& oldest = slots[position & mask];
+        if (oldest.sequence.load(std::memory_order_acquire) != position + 1) return false;
+        if (!dequeue_position.compare_exchange_strong(position, position + 1, std::memory_order_relaxed)) return false;
+        oldest.sequence.store(position + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    void wake_writer() {
+        // pairs with the fence in run_writer, so either the writer sees the new line or we see it asleep
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (writer_sleeping.load()) {
+            writer_sleeping.store(false);
+            writer_sleeping.notify_one();
+        }
+    }
+
+    void run_writer() {
+        std::vector<char> batch;
+        batch.reserve(64 * 1024);
+        for (;;) {
+            batch.clear();
+            size_t lines = 0;
+            size_t position = dequeue_position.load(std::memory_order_relaxed);
+            while (batch.size() < 64 * 1024) {
+                slot& next = slots[position & mask];
+                if (next.sequence.load(std::memory_order_acquire) != position + 1) break;
+                if (!dequeue_position.compare_exchange_strong(position, position + 1, std::memory_order_relaxed)) continue;
+                batch.insert(batch.end(), next.text, next.text + next.length);
+                batch.push_back('\n');
+                next.sequence.store(position + mask + 1, std::memory_order_release);
+                ++position;
+                ++lines;
+            }
+
+            if (lines != 0) {
+                std::fwrite(batch.data(), 1, batch.size(), sink);
+                std::fflush(sink);
+            }
+            flushed_position.store(position);
+            if (lines != 0) continue;
+            if (stopping.load()) return;
+
+            // nothing queued: sleep until a producer wakes us, re-checking once in case a line landed just now
+            writer_sleeping.store(true);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const slot& next = slots[dequeue_position.load() & mask];
+            if (next.sequence.load(std::memory_order_acquire) == dequeue_position.load() + 1 || stopping.load()) {
+                writer_sleeping.store(false);
+                continue;
+            }
+            writer_sleeping.wait(true);
+        }
+    }
+
+    FILE* sink;
+    const size_t mask;
+    std::unique_ptr<slot[]> slots;
+    alignas(64) std::atomic<size_t> enqueue_position{ 0 };
+    alignas(64) std::atomic<size_t> dequeue_position{ 0 };
+    alignas(64) std::atomic<size_t> flushed_position{ 0 };
+    std::atomic<size_t> dropped{ 0 }; // queued lines discarded to make room
+    std::atomic<size_t> rejected{ 0 }; // lines given up on before they were queued
+    std::atomic<bool> writer_sleeping{ false };
+    std::atomic<bool> stopping{ false };
+    std::thread writer;
+};
+
+/**
+ * The logger for the query path. It writes to stderr, so log lines never split the rows printed to stdout.
+ */
+async_logger& query_log() {
+    static async_logger logger(stderr);
+    return logger;
+}
+
+// the arguments are not evaluated at all when the level is compiled out
+#define SQLI_LOG(level, ...) \
+    do { \
+        if constexpr (level >= minimum_log_level) query_log().write(level, __VA_ARGS__); \
+    } while (0)
+
+#define LOG_TRACE(...) SQLI_LOG(log_level::trace, __VA_ARGS__)
+#define LOG_INFO(...) SQLI_LOG(log_level::info, __VA_ARGS__)
+#define LOG_WARN(...) SQLI_LOG(log_level::warn, __VA_ARGS__)
+#define LOG_ERROR(...) SQLI_LOG(log_level::error, __VA_ARGS__)
+
+/**
+ * A single token of SQL text. `text` is a view into the query being lexed, so tokens never own or copy anything.
+ * Quoted strings and identifiers keep their quotes, so 'Fred' and "Fred" stay distinct.
+ */
+struct sql_token {
+    enum class kind { end, identifier, quoted_identifier, string, number, parameter, op, comment };
+
+    kind type = kind::end;
+    std::string_view text;
+};
+
+/**
+ * Single-pass SQL tokenizer over a string_view. Handles '...' strings with '' escapes, "..." `...` and [...] quoted
+ * identifiers, -- and block comments, numbers, ?NNN :name @name $name parameters and one or two character operators.
+ * Whitespace is skipped. An unterminated string, identifier or comment runs to the end of the query. Every byte is
+ * looked at once and nothing is allocated, so lexing is linear in the query length.
+ */
+class sql_lexer {
+public:
+    explicit sql_lexer(std::string_view sql) : sql(sql) {}
+
+    /**
+     * Stores the next token in `token`. Returns false, with a token of kind end, once the query is exhausted.
+     */
+    bool next(sql_token& token) {
+        while (pos < sql.size() && is_space(sql[pos])) ++pos;
+        const size_t start = pos;
+        if (pos >= sql.size()) {
+            token = { sql_token::kind::end, sql.substr(start, 0) };
+            return false;
+        }
+
+        const char c = sql[pos];
+        sql_token::kind type = sql_token::kind::op;
+        if (c == '\'') {
+            type = sql_token::kind::string;
+            skip_quoted('\'');
+        }
+        else if (c == '"' || c == '`') {
+            type = sql_token::kind::quoted_identifier;
+            skip_quoted(c);
+        }
+        else if (c == '[') {
+            type = sql_token::kind::quoted_identifier;
+            skip_past(']');
+        }
+        else if (c == '-' && peek(1) == '-') {
+            type = sql_token::kind::comment;
+            skip_past('\n');
+        }
+        else if (c == '/' && peek(1) == '*') {
+            type = sql_token::kind::comment;
+            const size_t close = sql.find("*/", pos + 2);
+            pos = close == std::string_view::npos ? sql.size() : close + 2;
+        }
+        else if (is_digit(c) || (c == '.' && is_digit(peek(1)))) {
+            type = sql_token::kind::number;
+            while (pos < sql.size() && (is_word(sql[pos]) || sql[pos] == '.' ||
+                ((sql[pos] == '+' || sql[pos] == '-') && (sql[pos - 1] == 'e' || sql[pos - 1] == 'E')))) ++pos;
+        }
+        else if (c == '?' || ((c == ':' || c == '@' || c == '$') && is_word(peek(1)))) {
+            type = sql_token::kind::parameter;
+            ++pos;
+            while (pos < sql.size() && is_word(sql[pos])) ++pos;
+        }
+        else if (is_word(c)) {
+            type = sql_token::kind::identifier;
+            while (pos < sql.size() && is_word(sql[pos])) ++pos;
+        }
+        else {
+            // ==, !=, <>, <=, >=, ||, << and >> are the two character operators
+            const char second = peek(1);
+            ++pos;
+            if ((second == '=' && (c == '=' || c == '!' || c == '<' || c == '>')) || (c == '<' && (second == '>' || second == '<')) ||
+                (c == '>' && second == '>') || (c == '|' && second == '|')) ++pos;
+        }
+
+        token = { type, sql.substr(start, pos - start) };
+        return true;
+    }
+
+private:
+    static constexpr uint8_t space_class = 1, digit_class = 2, word_class = 4;
+
+    // byte classes looked up by table, so lexing does not go through the locale aware <cctype> calls
+    static constexpr std::array<uint8_t, 256> char_classes = []() {
+        std::array<uint8_t, 256> classes{};
+        for (int c = 0; c < 256; ++c) {
+            if (c == ' ' || (c >= '\t' && c <= '\r')) classes[c] = space_class;
+            else if (c >= '0' && c <= '9') classes[c] = digit_class | word_class;
+            else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c >= 0x80) classes[c] = word_class;
+        }
+        return classes;
+    }();
+
+    static bool is_space(char c) { return char_classes[static_cast<unsigned char>(c)] & space_class; }
+    static bool is_digit(char c) { return char_classes[static_cast<unsigned char>(c)] & digit_class; }
+    static bool is_word(char c) { return char_classes[static_cast<unsigned char>(c)] & word_class; }
+
+    char peek(size_t offset) const { return pos + offset < sql.size() ? sql[pos + offset] : '\0'; }
+
+    // moves past a quoted run that starts at pos, where a doubled quote is an escaped quote
+    void skip_quoted(char quote) {
+        ++pos;
+        while (pos < sql.size()) {
+            if (sql[pos++] == quote) {
+                if (pos < sql.size() && sql[pos] == quote) ++pos;
+                else return;
+            }
+        }
+    }
+
+    void skip_past(char terminator) {
+        const size_t found = sql.find(terminator, pos + 1);
+        pos = found == std::string_view::npos ? sql.size() : found + 1;
+    }
+
+    std::string_view sql;
+    size_t pos = 0;
+};
+
+/**
+ * Returns true if `token` can stand on either side of a comparison.
+ */
+bool is_operand_token(const sql_token& token) {
+    switch (token.type) {
+    case sql_token::kind::identifier:
+    case sql_token::kind::quoted_identifier:
+    case sql_token::kind::string:
+    case sql_token::kind::number:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * Watches a token stream for an equality whose two operands are the same token (e.g., 1=1, 'hi'='hi'). Only the
+ * previous operand is remembered, so checking is constant work per token. Comments between the operands are skipped,
+ * and an = inside a quoted string is part of that string and never a comparison.
+ */
+class tautology_tracker {
+public:
+    /**
+     * Feeds the next token of the query. Returns true once a tautology has been seen.
+     */
+    bool feed(const sql_token& token) {
+        if (token.type == sql_token::kind::comment) return found;
+        if (after_equals && is_operand_token(token) && token.text == left.text) found = true;
+        after_equals = token.type == sql_token::kind::op && (token.text == "=" || token.text == "==") && is_operand_token(previous);
+        left = previous;
+        previous = token;
+        return found;
+    }
+
+    bool tautology() const { return found; }
+
+private:
+    sql_token previous, left;
+    bool after_equals = false;
+    bool found = false;
+};
+
+/**
+ * Scans `query` in a single, allocation free pass for an equality whose operands are the same token.
+ */
+bool has_tautology(std::string_view query) {
+    sql_lexer lexer(query);
+    sql_token token;
+    tautology_tracker tracker;
+    while (lexer.next(token)) {
+        if (tracker.feed(token)) return true;
+    }
+    return false;
+}
+
+/**
+ * Returns true if `token` is `keyword`, ignoring case. `keyword` must be lower case.
+ */
+bool is_keyword(const sql_token& token, std::string_view keyword) {
+    if (token.type != sql_token::kind::identifier || token.text.size() != keyword.size()) return false;
+    for (size_t i = 0; i < keyword.size(); ++i) {
+        const char c = token.text[i];
+        if ((c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c) != keyword[i]) return false;
+    }
+    return true;
+}
+
+/**
+ * A value produced while folding a constant expression. `unknown` stands for anything that depends on a column,
+ * parameter or function, so it is not known until the query runs; `null` is SQL's NULL.
+ */
+struct sql_value {
+    enum class kind { unknown, null, integer, real, text };
+
+    kind type = kind::unknown;
+    int64_t integer = 0;
+    double real = 0.0;
+    std::string_view text;
+
+    static sql_value of(int64_t value) { return { kind::integer, value, 0.0, {} }; }
+    static sql_value of(double value) { return { kind::real, 0, value, {} }; }
+    static sql_value of_null() { return { kind::null, 0, 0.0, {} }; }
+};
+
+/**
+ * Folds an SQL expression over literals with SQLite's rules: integer and real arithmetic, ||, comparisons that order
+ * NULL < numbers < text, IS, LIKE, GLOB, BETWEEN, IN lists, NOT and three valued AND/OR. Anything that reads a column,
+ * parameter or function becomes unknown, and AND/OR fold around unknowns where the answer does not depend on them, so
+ * NAME='x' OR 2>1 is true. Unsupported syntax (CASE, COLLATE, ...) makes the whole expression unknown. It reads the
+ * tokens once, and text built by || or unescaping lives in a fixed buffer inside the folder, so nothing is allocated.
+ */
+class constant_folder {
+public:
+    explicit constant_folder(std::string_view expression) : lexer(expression) { advance(); }
+
+    /**
+     * Evaluates the expression; can only be called once.
+     */
+    sql_value evaluate() {
+        const sql_value result = parse(0);
+        if (failed || current.type != sql_token::kind::end) return {};
+        return result;
+    }
+
+    /**
+     * Returns true if `value` is known and true in a WHERE clause.
+     */
+    static bool is_true(const sql_value& value) { return truth(value) == logic::yes; }
+
+private:
+    enum class logic { no, yes, null, unknown };
+
+    enum class op {
+        none, logical_or, logical_and, equal, not_equal, is, is_not, less, less_equal, greater, greater_equal,
+        like, not_like, glob, not_glob, pattern, between, not_between, in, not_in, is_null, not_null,
+        bit_and, bit_or, shift_left, shift_right, add, subtract, multiply, divide, modulo, concat
+    };
+
+    // binding powers, loosest first; prefix NOT sits between AND and the comparisons
+    static constexpr int or_power = 1, and_power = 2, not_power = 3, equality_power = 4, relational_power = 5,
+        bitwise_power = 6, additive_power = 7, multiplicative_power = 8, concat_power = 9;
+
+    void advance() {
+        while (lexer.next(current) && current.type == sql_token::kind::comment) {}
+    }
+
+    sql_token peek() const {
+        sql_lexer ahead = lexer;
+        sql_token token;
+        while (ahead.next(token) && token.type == sql_token::kind::comment) {}
+        return token;
+    }
+
+    bool is_op(std::string_view text) const { return current.type == sql_token::kind::op && current.text == text; }
+
+    sql_value fail() {
+        failed = true;
+        return {};
+    }
+
+    // moves past a parenthesised run starting at the current "(", whatever it holds
+    sql_value skip_parentheses() {
+        int depth = 0;
+        do {
+            if (is_op("(")) ++depth;
+            else if (is_op(")")) --depth;
+            else if (current.type == sql_token::kind::end) return fail();
+            advance();
+        } while (depth > 0);
+        return {};
+    }
+
+    sql_value parse(int min_power) {
+        sql_value left = parse_prefix();
+        while (!failed) {
+            // operators are read eagerly, so one that binds too loosely for this level is put back
+            const sql_lexer saved_lexer = lexer;
+            const sql_token saved_token = current;
+            int power = 0;
+            const op infix = infix_operator(power);
+            if (infix == op::none || power <= min_power) {
+                lexer = saved_lexer;
+                current = saved_token;
+                break;
+            }
+
+            if (infix == op::is_null || infix == op::not_null) {
+                left = compare(infix == op::is_null ? op::is : op::is_not, left, sql_value::of_null());
+            }
+            else if (infix == op::between || infix == op::not_between) {
+                const sql_value low = parse(equality_power);
+                if (!is_keyword(current, "and")) return fail();
+                advance();
+                const sql_value high = parse(equality_power);
+                const sql_value inside = combine(op::logical_and, compare(op::greater_equal, left, low), compare(op::less_equal, left, high));
+                left = infix == op::between ? inside : negate(inside);
+            }
+            else if (infix == op::in || infix == op::not_in) {
+                const sql_value found = parse_in_list(left);
+                left = infix == op::in ? found : negate(found);
+            }
+            else {
+                const sql_value right = parse(power);
+                if (is_keyword(current, "escape")) return fail();
+                left = apply(infix, left, right);
+            }
+        }
+        return left;
+    }
+
+    // reads the operator at the current token, consuming it, and sets its binding power; returns none if the current
+    // token does not continue an expression
+    op infix_operator(int& power) {
+        struct symbol { std::string_view text; op kind; int power; };
+        static constexpr symbol symbols[] = {
+            { "=", op::equal, equality_power }, { "==", op::equal, equality_power }, { "!=", op::not_equal, equality_power },
+            { "<>", op::not_equal, equality_power }, { "<", op::less, relational_power }, { "<=", op::less_equal, relational_power },
+            { ">", op::greater, relational_power }, { ">=", op::greater_equal, relational_power }, { "&", op::bit_and, bitwise_power },
+            { "|", op::bit_or, bitwise_power }, { "<<", op::shift_left, bitwise_power }, { ">>", op::shift_right, bitwise_power },
+            { "+", op::add, additive_power }, { "-", op::subtract, additive_power }, { "*", op::multiply, multiplicative_power },
+            { "/", op::divide, multiplicative_power }, { "%", op::modulo, multiplicative_power }, { "||", op::concat, concat_power },
+        };
+        if (current.type == sql_token::kind::op) {
+            for (const symbol& candidate : symbols) {
+                if (current.text == candidate.text) {
+                    power = candidate.power;
+                    return take(candidate.kind);
+                }
+            }
+            return op::none;
+        }
+        if (current.type != sql_token::kind::identifier) return op::none;
+
+        power = equality_power;
+        if (is_keyword(current, "or")) {
+            power = or_power;
+            return take(op::logical_or);
+        }
+        if (is_keyword(current, "and")) {
+            power = and_power;
+            return take(op::logical_and);
+        }
+        if (is_keyword(current, "is")) {
+            advance();
+            bool negated = false;
+            if (is_keyword(current, "not")) {
+                negated = true;
+                advance();
+            }
+            if (is_keyword(current, "distinct")) {
+                advance();
+                if (!is_keyword(current, "from")) {
+                    fail();
+                    return op::none;
+                }
+                negated = !negated;
+                advance();
+            }
+            return negated ? op::is_not : op::is;
+        }
+        if (is_keyword(current, "isnull")) return take(op::is_null);
+        if (is_keyword(current, "notnull")) return take(op::not_null);
+        if (is_keyword(current, "like")) return take(op::like);
+        if (is_keyword(current, "glob")) return take(op::glob);
+        if (is_keyword(current, "regexp") || is_keyword(current, "match")) return take(op::pattern);
+        if (is_keyword(current, "between")) return take(op::between);
+        if (is_keyword(current, "in")) return take(op::in);
+        if (is_keyword(current, "not")) {
+            const sql_token next = peek();
+            op negated = op::none;
+            if (is_keyword(next, "null")) negated = op::not_null;
+            else if (is_keyword(next, "like")) negated = op::not_like;
+            else if (is_keyword(next, "glob")) negated = op::not_glob;
+            else if (is_keyword(next, "regexp") || is_keyword(next, "match")) negated = op::pattern;
+            else if (is_keyword(next, "between")) negated = op::not_between;
+            else if (is_keyword(next, "in")) negated = op::not_in;
+            if (negated == op::none) return op::none;
+            advance();
+            return take(negated);
+        }
+        return op::none;
+    }
+
+    op take(op kind) {
+        advance();
+        return kind;
+    }
+
+    sql_value parse_prefix() {
+        switch (current.type) {
+        case sql_token::kind::number:
+            return parse_number();
+        case sql_token::kind::string:
+            return parse_string();
+        case sql_token::kind::parameter:
+            advance();
+            return {};
+        case sql_token::kind::quoted_identifier:
+        case sql_token::kind::identifier:
+            return parse_name();
+        case sql_token::kind::op:
+            if (is_op("(")) {
+                const sql_token next = peek();
+                if (is_keyword(next, "select") || is_keyword(next, "with") || is_keyword(next, "values")) return skip_parentheses();
+                advance();
+                const sql_value inner = parse(0);
+                if (!is_op(")")) return fail();
+                advance();
+                return inner;
+            }
+            if (is_op("-") || is_op("+") || is_op("~")) {
+                const char sign = current.text[0];
+                advance();
+                const sql_value operand = parse(concat_power);
+                if (sign == '+') return operand;
+                if (sign == '~') return bitwise(op::bit_or, operand, sql_value::of(int64_t(0)), true);
+                return arithmetic(op::subtract, sql_value::of(int64_t(0)), operand);
+            }
+            return fail();
+        default:
+            return fail();
+        }
+    }
+
+    sql_value parse_number() {
+        const std::string_view text = current.text;
+        advance();
+        int64_t integer = 0;
+        if (text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+            uint64_t bits = 0;
+            const auto parsed = std::from_chars(text.data() + 2, text.data() + text.size(), bits, 16);
+            if (parsed.ec != std::errc() || parsed.ptr != text.data() + text.size()) return fail();
+            return sql_value::of(static_cast<int64_t>(bits));
+        }
+        auto parsed = std::from_chars(text.data(), text.data() + text.size(), integer);
+        if (parsed.ec == std::errc() && parsed.ptr == text.data() + text.size()) return sql_value::of(integer);
+        double real = 0.0;
+        parsed = std::from_chars(text.data(), text.data() + text.size(), real);
+        if (parsed.ec != std::errc() || parsed.ptr != text.data() + text.size()) return fail();
+        return sql_value::of(real);
+    }
+
+    sql_value parse_string() {
+        // drop the quotes, and only copy when a doubled '' has to be unescaped
+        std::string_view body = current.text.substr(1);
+        advance();
+        if (body.empty() || body.back() != '\'') return fail();
+        body.remove_suffix(1);
+        if (body.find('\'') == std::string_view::npos) return text_value(body);
+
+        char* start = arena + arena_used;
+        for (size_t i = 0; i < body.size(); ++i) {
+            if (arena_used == sizeof(arena)) return fail();
+            arena[arena_used++] = body[i];
+            if (body[i] == '\'') ++i;
+        }
+        return text_value(std::string_view(start, static_cast<size_t>(arena + arena_used - start)));
+    }
+
+    sql_value parse_name() {
+        if (is_keyword(current, "null")) return take_value(sql_value::of_null());
+        if (is_keyword(current, "true")) return take_value(sql_value::of(int64_t(1)));
+        if (is_keyword(current, "false")) return take_value(sql_value::of(int64_t(0)));
+        if (is_keyword(current, "not")) {
+            advance();
+            return negate(parse(not_power));
+        }
+        if (is_keyword(current, "case") || is_keyword(current, "raise")) return fail();
+
+        // a column, possibly qualified, or a function call: known only when the query runs
+        advance();
+        while (is_op(".")) {
+            advance();
+            if (current.type != sql_token::kind::identifier && current.type != sql_token::kind::quoted_identifier) return fail();
+            advance();
+        }
+        if (is_op("(")) return skip_parentheses();
+        return {};
+    }
+
+    sql_value parse_in_list(const sql_value& needle) {
+        if (!is_op("(")) {
+            // IN table or IN table-valued function
+            parse_name();
+            return {};
+        }
+        const sql_token next = peek();
+        if (is_keyword(next, "select") || is_keyword(next, "with") || is_keyword(next, "values")) return skip_parentheses();
+
+        advance();
+        logic found = logic::no;
+        while (!is_op(")") && !failed) {
+            const logic match = truth(compare(op::equal, needle, parse(0)));
+            if (match == logic::yes) found = logic::yes;
+            else if (found != logic::yes && match == logic::unknown) found = logic::unknown;
+            else if (found == logic::no && match == logic::null) found = logic::null;
+            if (is_op(",")) advance();
+            else if (!is_op(")")) return fail();
+        }
+        if (failed) return {};
+        advance();
+        return from_logic(found);
+    }
+
+    sql_value take_value(sql_value value) {
+        advance();
+        return value;
+    }
+
+    sql_value text_value(std::string_view text) {
+        sql_value value;
+        value.type = sql_value::kind::text;
+        value.text = text;
+        return value;
+    }
+
+    static logic truth(const sql_value& value) {
+        switch (value.type) {
+        case sql_value::kind::unknown: return logic::unknown;
+        case sql_value::kind::null: return logic::null;
+        case sql_value::kind::integer: return value.integer != 0 ? logic::yes : logic::no;
+        case sql_value::kind::real: return value.real != 0.0 ? logic::yes : logic::no;
+        default: {
+            const sql_value number = to_numeric(value);
+            return (number.type == sql_value::kind::integer ? number.integer != 0 : number.real != 0.0) ? logic::yes : logic::no;
+        }
+        }
+    }
+
+    static sql_value from_logic(logic value) {
+        switch (value) {
+        case logic::yes: return sql_value::of(int64_t(1));
+        case logic::no: return sql_value::of(int64_t(0));
+        case logic::null: return sql_value::of_null();
+        default: return {};
+        }
+    }
+
+    static sql_value negate(const sql_value& value) {
+        const logic result = truth(value);
+        return from_logic(result == logic::yes ? logic::no : result == logic::no ? logic::yes : result);
+    }
+
+    static sql_value combine(op kind, const sql_value& left, const sql_value& right) {
+        const logic a = truth(left), b = truth(right);
+        const logic decisive = kind == op::logical_or ? logic::yes : logic::no;
+        if (a == decisive || b == decisive) return from_logic(decisive);
+        if (a == logic::unknown || b == logic::unknown) return {};
+        if (a == logic::null || b == logic::null) return sql_value::of_null();
+        return from_logic(kind == op::logical_or ? logic::no : logic::yes);
+    }
+
+    // text to number the way SQLite does for arithmetic: the longest numeric prefix, or 0
+    static sql_value to_numeric(const sql_value& value) {
+        if (value.type != sql_value::kind::text) return value;
+        std::string_view text = value.text;
+        while (!text.empty() && (text.front() == ' ' || (text.front() >= '\t' && text.front() <= '\r'))) text.remove_prefix(1);
+        const char* first = text.data() + (!text.empty() && text.front() == '+' ? 1 : 0);
+        const char* last = text.data() + text.size();
+        int64_t integer = 0;
+        const auto whole = std::from_chars(first, last, integer);
+        if (whole.ec == std::errc() && (whole.ptr == last || (*whole.ptr != '.' && *whole.ptr != 'e' && *whole.ptr != 'E'))) return sql_value::of(integer);
+        double real = 0.0;
+        if (std::from_chars(first, last, real).ec == std::errc()) return sql_value::of(real);
+        return sql_value::of(int64_t(0));
+    }
+
+    static double as_real(const sql_value& number) {
+        return number.type == sql_value::kind::integer ? static_cast<double>(number.integer) : number.real;
+    }
+
+    static int64_t as_integer(const sql_value& number) {
+        if (number.type == sql_value::kind::integer) return number.integer;
+        if (!(number.real > -9.2e18 && number.real < 9.2e18)) return number.real > 0 ? INT64_MAX : INT64_MIN;
+        return static_cast<int64_t>(number.real);
+    }
+
+    sql_value apply(op kind, const sql_value& left, const sql_value& right) {
+        switch (kind) {
+        case op::logical_or:
+        case op::logical_and:
+            return combine(kind, left, right);
+        case op::add:
+        case op::subtract:
+        case op::multiply:
+        case op::divide:
+        case op::modulo:
+            return arithmetic(kind, left, right);
+        case op::bit_and:
+        case op::bit_or:
+        case op::shift_left:
+        case op::shift_right:
+            return bitwise(kind, left, right, false);
+        case op::concat:
+            return concatenate(left, right);
+        case op::like:
+        case op::not_like:
+        case op::glob:
+        case op::not_glob: {
+            const sql_value matched = match_pattern(kind == op::like || kind == op::not_like, left, right);
+            return kind == op::like || kind == op::glob ? matched : negate(matched);
+        }
+        case op::pattern:
+            return {};
+        default:
+            return compare(kind, left, right);
+        }
+    }
+
+    static sql_value arithmetic(op kind, const sql_value& left, const sql_value& right) {
+        if (left.type == sql_value::kind::unknown || right.type == sql_value::kind::unknown) return {};
+        if (left.type == sql_value::kind::null || right.type == sql_value::kind::null) return sql_value::of_null();
+        const sql_value a = to_numeric(left), b = to_numeric(right);
+
+        if (kind == op::modulo) {
+            const int64_t divisor = as_integer(b);
+            if (divisor == 0) return sql_value::of_null();
+            return sql_value::of(divisor == -1 ? int64_t(0) : as_integer(a) % divisor);
+        }
+        if (a.type == sql_value::kind::integer && b.type == sql_value::kind::integer) {
+            const int64_t x = a.integer, y = b.integer;
+            switch (kind) {
+            case op::add:
+                if ((y > 0 && x <= INT64_MAX - y) || (y <= 0 && x >= INT64_MIN - y)) return sql_value::of(x + y);
+                break;
+            case op::subtract:
+                if ((y < 0 && x <= INT64_MAX + y) || (y >= 0 && x >= INT64_MIN + y)) return sql_value::of(x - y);
+                break;
+            case op::multiply:
+                if (std::abs(static_cast<double>(x) * static_cast<double>(y)) < 9.2e18) return sql_value::of(x * y);
+                break;
+            default:
+                if (y == 0) return sql_value::of_null();
+                if (!(x == INT64_MIN && y == -1)) return sql_value::of(x / y);
+                break;
+            }
+        }
+        // reals, or integers that overflowed, which SQLite also redoes as reals
+        const double x = as_real(a), y = as_real(b);
+        switch (kind) {
+        case op::add: return sql_value::of(x + y);
+        case op::subtract: return sql_value::of(x - y);
+        case op::multiply: return sql_value::of(x * y);
+        default: return y == 0.0 ? sql_value::of_null() : sql_value::of(x / y);
+        }
+    }
+
+    // `invert` turns bit_or with 0 into the unary ~
+    static sql_value bitwise(op kind, const sql_value& left, const sql_value& right, bool invert) {
+        if (left.type == sql_value::kind::unknown || right.type == sql_value::kind::unknown) return {};
+        if (left.type == sql_value::kind::null || right.type == sql_value::kind::null) return sql_value::of_null();
+        const uint64_t a = static_cast<uint64_t>(as_integer(to_numeric(left)));
+        int64_t shift = as_integer(to_numeric(right));
+        if (invert) return sql_value::of(static_cast<int64_t>(~a));
+        if (kind == op::bit_and) return sql_value::of(static_cast<int64_t>(a & static_cast<uint64_t>(shift)));
+        if (kind == op::bit_or) return sql_value::of(static_cast<int64_t>(a | static_cast<uint64_t>(shift)));
+
+        // a negative shift goes the other way; shifting 64 or more places leaves only the sign
+        bool left_shift = kind == op::shift_left;
+        if (shift < 0) {
+            left_shift = !left_shift;
+            shift = shift == INT64_MIN ? 64 : -shift;
+        }
+        if (shift >= 64) return sql_value::of(left_shift || static_cast<int64_t>(a) >= 0 ? int64_t(0) : int64_t(-1));
+        if (left_shift) return sql_value::of(static_cast<int64_t>(a << shift));
+        return sql_value::of(static_cast<int64_t>(a) >> shift);
+    }
+
+    static sql_value compare(op kind, const sql_value& left, const sql_value& right) {
+        if (left.type == sql_value::kind::unknown || right.type == sql_value::kind::unknown) return {};
+        const bool left_null = left.type == sql_value::kind::null, right_null = right.type == sql_value::kind::null;
+        if (kind == op::is || kind == op::is_not) {
+            const bool same = left_null || right_null ? left_null == right_null : order(left, right) == 0;
+            return sql_value::of(int64_t(same == (kind == op::is)));
+        }
+        if (left_null || right_null) return sql_value::of_null();
+
+        const int ordering = order(left, right);
+        switch (kind) {
+        case op::equal: return sql_value::of(int64_t(ordering == 0));
+        case op::not_equal: return sql_value::of(int64_t(ordering != 0));
+        case op::less: return sql_value::of(int64_t(ordering < 0));
+        case op::less_equal: return sql_value::of(int64_t(ordering <= 0));
+        case op::greater: return sql_value::of(int64_t(ordering > 0));
+        default: return sql_value::of(int64_t(ordering >= 0));
+        }
+    }
+
+    // numbers sort before text, as in SQLite when neither side has a column affinity
+    static int order(const sql_value& left, const sql_value& right) {
+        const bool left_text = left.type == sql_value::kind::text, right_text = right.type == sql_value::kind::text;
+        if (left_text != right_text) return left_text ? 1 : -1;
+        if (left_text) return left.text.compare(right.text);
+        if (left.type == sql_value::kind::integer && right.type == sql_value::kind::integer) {
+            return left.integer < right.integer ? -1 : left.integer > right.integer ? 1 : 0;
+        }
+        const double a = as_real(left), b = as_real(right);
+        return a < b ? -1 : a > b ? 1 : 0;
+    }
+
+    // writes `value` as text at the end of the arena
+    bool append_text(const sql_value& value) {
+        char* const end = arena + sizeof(arena);
+        char* out = arena + arena_used;
+        if (value.type == sql_value::kind::text) {
+            if (value.text.size() > static_cast<size_t>(end - out)) return false;
+            std::memcpy(out, value.text.data(), value.text.size());
+            arena_used += value.text.size();
+            return true;
+        }
+        const auto written = value.type == sql_value::kind::integer ? std::to_chars(out, end, value.integer)
+            : std::to_chars(out, end, value.real, std::chars_format::general, 15);
+        if (written.ec != std::errc()) return false;
+        std::string_view digits(out, static_cast<size_t>(written.ptr - out));
+        arena_used += digits.size();
+        // SQLite always shows a real with a decimal point or exponent
+        if (value.type == sql_value::kind::real && digits.find_first_of(".eni") == std::string_view::npos) {
+            if (end - written.ptr < 2) return false;
+            arena[arena_used++] = '.';
+            arena[arena_used++] = '0';
+        }
+        return true;
+    }
+
+    sql_value concatenate(const sql_value& left, const sql_value& right) {
+        if (left.type == sql_value::kind::unknown || right.type == sql_value::kind::unknown) return {};
+        if (left.type == sql_value::kind::null || right.type == sql_value::kind::null) return sql_value::of_null();
+        const size_t start = arena_used;
+        if (!append_text(left) || !append_text(right)) return fail();
+        return text_value(std::string_view(arena + start, arena_used - start));
+    }
+
+    sql_value match_pattern(bool like, const sql_value& left, const sql_value& right) {
+        if (left.type == sql_value::kind::unknown || right.type == sql_value::kind::unknown) return {};
+        if (left.type == sql_value::kind::null || right.type == sql_value::kind::null) return sql_value::of_null();
+        const size_t start = arena_used;
+        if (!append_text(left)) return fail();
+        const size_t middle = arena_used;
+        if (!append_text(right)) return fail();
+        const std::string_view text(arena + start, middle - start), pattern(arena + middle, arena_used - middle);
+        if (!like && pattern.find('[') != std::string_view::npos) return {};
+        return sql_value::of(int64_t(wildcard_match(text, pattern, like ? '%' : '*', like ? '_' : '?', like)));
+    }
+
+    // iterative wildcard match that backtracks only to the most recent `any_run`
+    static bool wildcard_match(std::string_view text, std::string_view pattern, char any_run, char any_one, bool fold_case) {
+        auto same = [fold_case](char a, char b) {
+            if (!fold_case) return a == b;
+            return (a >= 'A' && a <= 'Z' ? a - 'A' + 'a' : a) == (b >= 'A' && b <= 'Z' ? b - 'A' + 'a' : b);
+        };
+        size_t t = 0, p = 0, star = std::string_view::npos, resume = 0;
+        while (t < text.size()) {
+            if (p < pattern.size() && pattern[p] == any_run) {
+                star = p++;
+                resume = t;
+            }
+            else if (p < pattern.size() && (pattern[p] == any_one || same(pattern[p], text[t]))) {
+                ++p;
+                ++t;
+            }
+            else if (star != std::string_view::npos) {
+                p = star + 1;
+                t = ++resume;
+            }
+            else {
+                return false;
+            }
+        }
+        while (p < pattern.size() && pattern[p] == any_run) ++p;
+        return p == pattern.size();
+    }
+
+    sql_lexer lexer;
+    sql_token current;
+    bool failed = false;
+    char arena[512];
+    size_t arena_used = 0;
+};
+
+/**
+ * Calls `visit` with the text of each top level OR branch of the top level WHERE clause of `sql`, stopping early when
+ * it returns true. Returns whether any call did. WHERE clauses of subqueries are part of the branch they sit in.
+ */
+template <typename Visitor>
+bool visit_where_branches(std::string_view sql, Visitor&& visit) {
+    static constexpr std::string_view clause_ends[] = { "group", "order", "limit", "having", "window", "union", "intersect", "except", "returning" };
+
+    sql_lexer lexer(sql);
+    sql_token token;
+    int depth = 0;
+    bool in_where = false;
+    const char* branch_start = NULL;
+    const char* branch_end = NULL;
+
+    while (lexer.next(token)) {
+        if (token.type == sql_token::kind::comment) continue;
+        if (depth == 0 && !in_where && is_keyword(token, "where")) {
+            in_where = true;
+            branch_start = NULL;
+            continue;
+        }
+        const bool semicolon = token.type == sql_token::kind::op && token.text == ";";
+        if (depth == 0 && in_where && (token.type == sql_token::kind::identifier || semicolon)) {
+            // every clause keyword is at least five letters long, which rules out most column names quickly
+            const bool clause_end = semicolon || (token.text.size() >= 5 &&
+                std::any_of(std::begin(clause_ends), std::end(clause_ends), [&](std::string_view word) { return is_keyword(token, word); }));
+            if (clause_end || is_keyword(token, "or")) {
+                if (branch_start != NULL && visit(std::string_view(branch_start, static_cast<size_t>(branch_end - branch_start)))) return true;
+                branch_start = NULL;
+                in_where = !clause_end;
+                continue;
+            }
+        }
+        if (token.type == sql_token::kind::op && token.text == "(") ++depth;
+        else if (token.type == sql_token::kind::op && token.text == ")") --depth;
+        if (!in_where) continue;
+
+        if (branch_start == NULL) branch_start = token.text.data();
+        branch_end = token.text.data() + token.text.size();
+    }
+    return in_where && branch_start != NULL && visit(std::string_view(branch_start, static_cast<size_t>(branch_end - branch_start)));
+}
+
+/**
+ * Returns true if a top level OR branch of the WHERE clause of `query` folds to a constant true (e.g., 2>1, 1+1=2,
+ * 'a'||'b'='ab', NAME='x' OR 1), so the WHERE clause matches every row. If `branch` is given it receives the branch.
+ */
+bool has_always_true_branch(std::string_view query, std::string_view* branch = NULL) {
+    return visit_where_branches(query, [branch](std::string_view candidate) {
+        if (!constant_folder::is_true(constant_folder(candidate).evaluate())) return false;
+        if (branch != NULL) *branch = candidate;
+        return true;
+    });
+}
+
+/**
+ * A byte pattern that suggests an injection. Patterns are lower case and a single space in a pattern stands for any
+ * run of whitespace in the query. A pattern with `needs_trailing_text` only counts when something other than
+ * whitespace follows it, so a stacked statement is flagged but a query's own closing ; is not. A pattern with
+ * `needs_word_start` only counts when it does not continue an identifier, so char( is flagged but varchar( is not;
+ * such patterns must not contain spaces.
+ */
+struct injection_signature {
+    std::string_view pattern;
+    std::string_view description;
+    bool needs_trailing_text = false;
+    bool needs_word_start = false;
+};
+
+constexpr injection_signature injection_signatures[] = {
+    { "union select", "UNION SELECT" },
+    { "union all select", "UNION ALL SELECT" },
+    { "--", "line comment" },
+    { "/*", "block comment" },
+    { ";", "stacked statement", true },
+    { "' or '", "quoted OR tautology" },
+    { "' or 1", "quoted OR tautology" },
+    { " or 1=1", "OR tautology" },
+    { " or true", "OR tautology" },
+    { "sleep(", "time delay", false, true },
+    { "benchmark(", "time delay", false, true },
+    { "waitfor delay", "time delay" },
+    { "randomblob(", "time delay", false, true },
+    { "load_extension(", "extension load", false, true },
+    { "attach database", "ATTACH DATABASE" },
+    { "sqlite_master", "schema probe" },
+    { "sqlite_schema", "schema probe" },
+    { "information_schema", "schema probe" },
+    { "pragma ", "PRAGMA" },
+    { "drop table", "DROP TABLE" },
+    { "xp_cmdshell", "shell command" },
+    { "char(", "encoded characters", false, true },
+};
+
+/**
+ * Aho-Corasick matcher that checks every signature in one pass over a query. The automaton is compiled into a dense
+ * transition table over byte classes, with case folding and whitespace built into the class map, so each query byte
+ * costs one table lookup and runs of whitespace are collapsed as they are read. While the automaton is at its root it
+ * skips bytes that cannot start any signature. Supports up to 64 signatures.
+ */
+class signature_scanner {
+public:
+    template <size_t N>
+    explicit signature_scanner(const injection_signature (&signatures)[N]) : signatures(signatures, N) {
+        static_assert(N <= 64, "match masks are 64 bits wide");
+        build();
+    }
+
+    /**
+     * Calls `on_match(index, end)` for every occurrence of every signature in `query`, where `index` is the position
+     * in the signature table and `end` is the offset just past the last matched byte.
+     */
+    template <typename OnMatch>
+    void scan(std::string_view query, OnMatch&& on_match) const {
+        const auto* bytes = reinterpret_cast<const unsigned char*>(query.data());
+        const size_t size = query.size();
+        uint32_t state = 0;
+        bool in_space = false;
+        for (size_t i = 0; i < size; ++i) {
+            if (state == 0) {
+                while (i < size && !starts_signature[bytes[i]]) ++i;
+                if (i == size) break;
+                in_space = false;
+            }
+            const bool space = is_space[bytes[i]];
+            if (space && in_space) continue;
+            in_space = space;
+
+            state = transitions[state * class_count + byte_class[bytes[i]]];
+            for (uint64_t found = outputs[state]; found != 0; found &= found - 1) {
+                const size_t index = static_cast<size_t>(std::countr_zero(found));
+                const injection_signature& signature = signatures[index];
+                if ((!signature.needs_trailing_text || has_trailing_text(query, i + 1)) &&
+                    (!signature.needs_word_start || starts_word(query, i + 1 - signature.pattern.size()))) {
+                    on_match(index, i + 1);
+                }
+            }
+        }
+    }
+
+    /**
+     * Returns a mask with bit i set if signature i occurs in `query`.
+     */
+    uint64_t match_mask(std::string_view query) const {
+        uint64_t mask = 0;
+        scan(query, [&mask](size_t index, size_t) { mask |= uint64_t(1) << index; });
+        return mask;
+    }
+
+    const injection_signature& signature(size_t index) const { return signatures[index]; }
+
+private:
+    static bool has_trailing_text(std::string_view query, size_t from) {
+        for (size_t i = from; i < query.size(); ++i) {
+            if (!std::isspace(static_cast<unsigned char>(query[i]))) return true;
+        }
+        return false;
+    }
+
+    static bool starts_word(std::string_view query, size_t start) {
+        if (start == 0) return true;
+        const unsigned char before = static_cast<unsigned char>(query[start - 1]);
+        return !std::isalnum(before) && before != '_' && before != '$' && before < 0x80;
+    }
+
+    void build() {
+        // every byte that appears in a pattern gets its own class, both cases of a letter share one, and every
+        // whitespace byte maps to the class of ' '
+        for (const injection_signature& signature : signatures) {
+            for (char c : signature.pattern) {
+                const unsigned char byte = static_cast<unsigned char>(c);
+                if (byte_class[byte] == 0) byte_class[byte] = static_cast<uint8_t>(class_count++);
+            }
+        }
+        for (int byte = 0; byte < 256; ++byte) {
+            is_space[byte] = std::isspace(byte) != 0;
+            if (std::isupper(byte)) byte_class[byte] = byte_class[std::tolower(byte)];
+            else if (is_space[byte]) byte_class[byte] = byte_class[static_cast<unsigned char>(' ')];
+        }
+
+        // the trie, with 0 as "no edge yet"
+        transitions.assign(class_count, 0);
+        outputs.assign(1, 0);
+        for (size_t index = 0; index < signatures.size(); ++index) {
+            uint32_t state = 0;
+            for (char c : signatures[index].pattern) {
+                uint32_t& edge = transitions[state * class_count + byte_class[static_cast<unsigned char>(c)]];
+                if (edge == 0) {
+                    edge = static_cast<uint32_t>(outputs.size());
+                    outputs.push_back(0);
+                    transitions.resize(transitions.size() + class_count, 0);
+                }
+                state = transitions[state * class_count + byte_class[static_cast<unsigned char>(c)]];
+            }
+            outputs[state] |= uint64_t(1) << index;
+        }
+
+        // breadth first, fill in the missing edges from each state's failure state and inherit its outputs
+        std::vector<uint32_t> failure(outputs.size(), 0), order;
+        order.reserve(outputs.size());
+        for (size_t c = 0; c < class_count; ++c) {
+            if (transitions[c] != 0) order.push_back(transitions[c]);
+        }
+        for (size_t head = 0; head < order.size(); ++head) {
+            const uint32_t state = order[head];
+            outputs[state] |= outputs[failure[state]];
+            for (size_t c = 0; c < class_count; ++c) {
+                uint32_t& edge = transitions[state * class_count + c];
+                const uint32_t fallback = transitions[failure[state] * class_count + c];
+                if (edge == 0) {
+                    edge = fallback;
+                }
+                else {
+                    failure[edge] = fallback;
+                    order.push_back(edge);
+                }
+            }
+        }
+
+        for (int byte = 0; byte < 256; ++byte) {
+            starts_signature[byte] = byte_class[byte] != 0 && transitions[byte_class[byte]] != 0;
+        }
+    }
+
+    std::span<const injection_signature> signatures;
+    uint8_t byte_class[256] = {};
+    size_t class_count = 1;
+    bool starts_signature[256] = {};
+    bool is_space[256] = {};
+    std::vector<uint32_t> transitions;
+    std::vector<uint64_t> outputs;
+};
+
+/**
+ * Returns the scanner compiled from injection_signatures, built on first use.
+ */
+const signature_scanner& injection_scanner() {
+    static const signature_scanner scanner(injection_signatures);
+    return scanner;
+}
+
+/**
+ * 64-bit FNV-1a hash of `text`.
+ */
+uint64_t fnv1a_64(std::string_view text) {
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : text) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+/**
+ * Result of checking one query with every is_unsafe_query check.
+ */
+struct query_verdict {
+    bool tautology;
+    bool always_true; // a top level WHERE branch folds to true
+    std::string always_true_branch;
+    uint64_t signatures; // injection_scanner match mask
+
+    bool unsafe() const { return tautology || always_true || signatures != 0; }
+};
+
+/**
+ * Works out the verdict for `query` from scratch: the tautology check, the WHERE clause constant folding and the
+ * signature scan.
+ */
+query_verdict check_query(std::string_view query) {
+    query_verdict verdict{ has_tautology(query), false, std::string(), injection_scanner().match_mask(query) };
+    std::string_view branch;
+    verdict.always_true = has_always_true_branch(query, &branch);
+    if (verdict.always_true) verdict.always_true_branch = branch;
+    return verdict;
+}
+
+/**
+ * Bounded cache of whole query verdicts keyed by a hash of the exact query text, so a query seen before costs one
+ * hash and one comparison instead of lexing, folding and scanning it again. Every check depends on the literals, so
+ * queries are only shared when their text is identical; applications repeat the same text far more often than not.
+ * The cache is split into shards, each an LRU list behind its own mutex, so threads checking different queries rarely
+ * contend. Entries keep their text and a hit compares it, so two queries with the same hash never share a verdict.
+ */
+class verdict_cache {
+public:
+    explicit verdict_cache(size_t capacity = 4096) : shard_capacity(std::max<size_t>(1, capacity / shard_count)) {}
+
+    verdict_cache(const verdict_cache&) = delete;
+    verdict_cache& operator=(const verdict_cache&) = delete;
+
+    /**
+     * Returns the verdict for `query`, checking it only if the same text is not cached yet.
+     */
+    query_verdict check(std::string_view query) {
+        const uint64_t fingerprint = fnv1a_64(query);
+        shard& owner = shards[fingerprint >> 60];
+
+        {
+            std::lock_guard<std::mutex> lock(owner.mutex);
+            auto found = owner.index.find(fingerprint);
+            if (found != owner.index.end() && found->second->query == query) {
+                owner.entries.splice(owner.entries.begin(), owner.entries, found->second);
+                hit_count.fetch_add(1, std::memory_order_relaxed);
+                return found->second->verdict;
+            }
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        query_verdict verdict = check_query(query);
+        const std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+        miss_count.fetch_add(1, std::memory_order_relaxed);
+        miss_nanoseconds.fetch_add(static_cast<uint64_t>(elapsed.count()), std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> lock(owner.mutex);
+        auto found = owner.index.find(fingerprint);
+        if (found != owner.index.end()) {
+            // another thread got here first, or a different query with the same hash: keep the newest
+            owner.entries.erase(found->second);
+            owner.index.erase(found);
+        }
+        else if (owner.entries.size() >= shard_capacity) {
+            owner.index.erase(owner.entries.back().fingerprint);
+            owner.entries.pop_back();
+        }
+        owner.entries.push_front(entry{ fingerprint, std::string(query), verdict });
+        owner.index.emplace(fingerprint, owner.entries.begin());
+        return verdict;
+    }
+
+    uint64_t hits() const { return hit_count.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return miss_count.load(std::memory_order_relaxed); }
+
+    /**
+     * Average time a miss spent checking, which is what each hit saves.
+     */
+    std::chrono::duration<double, std::micro> average_check_time() const {
+        const uint64_t misses = miss_count.load(std::memory_order_relaxed);
+        return std::chrono::duration<double, std::micro>(misses == 0 ? 0.0 :
+            miss_nanoseconds.load(std::memory_order_relaxed) / 1000.0 / static_cast<double>(misses));
+    }
+
+private:
+    static constexpr size_t shard_count = 16;
+
+    struct entry {
+        uint64_t fingerprint;
+        std::string query;
+        query_verdict verdict;
+    };
+
+    struct shard {
+        std::mutex mutex;
+        std::list<entry> entries;
+        std::unordered_map<uint64_t, std::list<entry>::iterator> index;
+    };
+
+    size_t shard_capacity;
+    shard shards[shard_count];
+    std::atomic<uint64_t> hit_count{ 0 };
+    std::atomic<uint64_t> miss_count{ 0 };
+    std::atomic<uint64_t> miss_nanoseconds{ 0 };
+};
+
+/**
+ * The process wide verdict cache used by is_unsafe_query.
+ */
+verdict_cache& query_verdict_cache() {
+    static verdict_cache cache;
+    return cache;
+}
+
+/**
+ * Prints the verdict cache hit ratio and the checking time the hits saved.
+ */
+void report_verdict_cache() {
+    const verdict_cache& cache = query_verdict_cache();
+    const uint64_t lookups = cache.hits() + cache.misses();
+    const double hit_ratio = lookups == 0 ? 0.0 : 100.0 * static_cast<double>(cache.hits()) / static_cast<double>(lookups);
+    std::cout << "Verdict cache: " << cache.hits() << " hits, " << cache.misses() << " misses ("
+        << std::fixed << std::setprecision(1) << hit_ratio << "% hit ratio), average check "
+        << std::setprecision(2) << cache.average_check_time().count() << " us, about "
+        << cache.average_check_time().count() * static_cast<double>(cache.hits()) / 1000.0 << " ms of checking saved" << std::endl;
+}
+
+/**
+ * Regression check for the signatures that match part of a number literal, which a cache keyed on query shapes once
+ * missed: each query is checked twice through a fresh verdict_cache, so that the second check is a cache hit, and must
+ * be flagged by its signature both times. Prints the query that got through and returns false otherwise.
+ */
+bool check_literal_signatures() {
+    struct regression {
+        std::string_view pattern;
+        std::string_view query;
+    };
+    static constexpr regression regressions[] = {
+        { "' or 1", "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' or 1" },
+        { " or 1=1", "SELECT ID, NAME, PASSWORD FROM USERS WHERE ID=2 or 1=1" },
+    };
+
+    verdict_cache cache;
+    for (const regression& next : regressions) {
+        const auto signature = std::find_if(std::begin(injection_signatures), std::end(injection_signatures),
+            [&next](const injection_signature& candidate) { return candidate.pattern == next.pattern; });
+        const uint64_t bit = uint64_t(1) << (signature - std::begin(injection_signatures));
+        for (int pass = 0; pass < 2; ++pass) {
+            if (signature == std::end(injection_signatures) || (cache.check(next.query).signatures & bit) == 0) {
+                std::cout << "Signature \"" << next.pattern << "\" missed " << next.query << (pass == 0 ? "" : " on a cache hit") << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Checks the sqlite query `query` for a suspected sql injection. Returns true if an injection is suspected.
+ */
+bool is_unsafe_query(const std::string& query) {
+	/**
+    * The SQL injection method used in this code is performing any conditional statement that always returns true (e.g., 1=1, 'hi'='hi')
+    * There isn't a reason a SQL query needs have that type of statement, so that is checked for and if found, an injection is suspected
+    * and the query is not run.
+    */
+    LOG_TRACE("Checking query: ", query);
+    // the whole verdict is shared by every check of the same query text
+    const query_verdict verdict = query_verdict_cache().check(query);
+    if (verdict.always_true) {
+        LOG_WARN("WHERE branch is always true: ", verdict.always_true_branch);
+    }
+
+    // every signature hit is reported, not just the first
+    for (uint64_t found = verdict.signatures; found != 0; found &= found - 1) {
+        const injection_signature& signature = injection_scanner().signature(static_cast<size_t>(std::countr_zero(found)));
+        LOG_WARN("Signature matched: ", signature.description, " (", signature.pattern, ")");
+    }
+
+    if (verdict.unsafe()) {
+        // Operands match, a branch is always true or a signature hit, suspected SQL injection
+        LOG_WARN("SQL INJECTION DETECTED WEE WOO WEE WOO PULL OVER");
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Per-connection LRU cache of prepared statements keyed by their SQL text. Statements are prepared once with
+ * SQLITE_PREPARE_PERSISTENT and reset for reuse, so repeated queries skip tokenizing, parsing and planning.
+ * A cache, and every statement it hands out, must only be used by one thread at a time.
+ */
+class statement_cache {
+public:
+    explicit statement_cache(sqlite3* db, size_t capacity = 64) : db(db), capacity(capacity) {}
+
+    ~statement_cache() {
+        for (auto& entry : entries) sqlite3_finalize(entry.statement);
+    }
+
+    statement_cache(const statement_cache&) = delete;
+    statement_cache& operator=(const statement_cache&) = delete;
+
+    using authorizer_callback = int (*)(void*, int, const char*, const char*, const char*, const char*);
+
+    /**
+     * Injection check result for a cached SQL text, worked out once when the statement is first used.
+     */
+    enum class verdict { unchecked, safe, unsafe };
+
+    struct entry {
+        std::string sql;
+        sqlite3_stmt* statement;
+        bool complete; // false when the SQL held more than one statement; only the first one was prepared
+        const char* hazard; // set by the authorizer when preparing saw something an injected query would try
+        verdict check;
+    };
+
+    /**
+     * Returns the entry for `sql` with its statement reset and its bindings cleared, preparing it on a miss, or NULL if
+     * it does not prepare or holds no statement at all, like whitespace or a comment. The entry stays owned by the cache and remains valid until `capacity` other statements have
+     * been acquired.
+     */
+    entry* acquire(const std::string& sql) {
+        auto found = index.find(sql);
+        if (found != index.end()) {
+            ++hit_count;
+            // move to the front: the back of the list is always the least recently used statement
+            entries.splice(entries.begin(), entries, found->second);
+            sqlite3_reset(found->second->statement);
+            sqlite3_clear_bindings(found->second->statement);
+            return &*found->second;
+        }
+
+        ++miss_count;
+        const auto start = std::chrono::steady_clock::now();
+        sqlite3_stmt* statement = NULL;
+        const char* tail = NULL;
+        // record_hazard only records what the statement would do and passes every request on to the connection's
+        // own authorizer, which is put back afterwards
+        prepare_audit audit{ NULL, authorizer, authorizer_data };
+        sqlite3_set_authorizer(db, record_hazard, &audit);
+        const int result = sqlite3_prepare_v3(db, sql.c_str(), static_cast<int>(sql.size() + 1), SQLITE_PREPARE_PERSISTENT, &statement, &tail);
+        sqlite3_set_authorizer(db, authorizer, authorizer_data);
+        const char* hazard = audit.hazard;
+        if (result != SQLITE_OK || statement == NULL) {
+            sqlite3_finalize(statement);
+            return NULL;
+        }
+        prepare_time += std::chrono::steady_clock::now() - start;
+
+        const bool complete = tail == NULL || std::all_of(tail, sql.c_str() + sql.size(), [](char c) { return std::isspace(static_cast<unsigned char>(c)); });
+
+        if (entries.size() >= capacity) {
+            index.erase(entries.back().sql);
+            sqlite3_finalize(entries.back().statement);
+            entries.pop_back();
+        }
+        entries.push_front(entry{ sql, statement, complete, hazard, verdict::unchecked });
+        // the key views the string inside the list node, which never moves
+        index.emplace(entries.front().sql, entries.begin());
+        return &entries.front();
+    }
+
+    size_t hits() const { return hit_count; }
+    size_t misses() const { return miss_count; }
+
+    /**
+     * Installs `callback` as the connection's authorizer, or removes it when NULL. A connection with a statement cache
+     * must have its authorizer set here rather than with sqlite3_set_authorizer, since SQLite cannot report the
+     * authorizer installed and acquire has to put it back after preparing.
+     */
+    void set_authorizer(authorizer_callback callback, void* data) {
+        authorizer = callback;
+        authorizer_data = data;
+        sqlite3_set_authorizer(db, callback, data);
+    }
+
+    /**
+     * Average time spent preparing a statement on a miss.
+     */
+    std::chrono::duration<double, std::micro> average_prepare_time() const {
+        return miss_count == 0 ? std::chrono::duration<double, std::micro>(0) : prepare_time / static_cast<double>(miss_count);
+    }
+
+private:
+    struct prepare_audit {
+        const char* hazard;
+        authorizer_callback authorizer;
+        void* authorizer_data;
+    };
+
+    /**
+     * Authorizer callback used while preparing. Reading SQLite's internal tables, attaching or detaching a database,
+     * running a PRAGMA and calling functions that load code or burn time are the things injected SQL reaches for; the
+     * first one found is stored in the audit's `hazard` as a description. Ordinary reads and writes are not recorded.
+     * The decision itself is left to the connection's own authorizer, if it has one.
+     */
+    static int record_hazard(void* context, int action, const char* detail1, const char* detail2, const char* database, const char* trigger) {
+        prepare_audit& audit = *static_cast<prepare_audit*>(context);
+        const char* description = NULL;
+        switch (action) {
+        case SQLITE_READ:
+            if (detail1 != NULL && sqlite3_strnicmp(detail1, "sqlite_", 7) == 0) description = "reads SQLite's internal tables";
+            break;
+        case SQLITE_FUNCTION:
+            if (detail2 != NULL && (sqlite3_stricmp(detail2, "load_extension") == 0 || sqlite3_stricmp(detail2, "randomblob") == 0 ||
+                sqlite3_stricmp(detail2, "zeroblob") == 0)) description = "calls a function that loads code or burns time";
+            break;
+        case SQLITE_ATTACH:
+        case SQLITE_DETACH:
+            description = "attaches or detaches a database";
+            break;
+        case SQLITE_PRAGMA:
+            description = "runs a PRAGMA";
+            break;
+        default:
+            break;
+        }
+        if (audit.hazard == NULL) audit.hazard = description;
+        return audit.authorizer == NULL ? SQLITE_OK : audit.authorizer(audit.authorizer_data, action, detail1, detail2, database, trigger);
+    }
+
+    sqlite3* db;
+    size_t capacity;
+    authorizer_callback authorizer = NULL;
+    void* authorizer_data = NULL;
+    std::list<entry> entries;
+    std::unordered_map<std::string_view, std::list<entry>::iterator> index;
+    size_t hit_count = 0;
+    size_t miss_count = 0;
+    std::chrono::duration<double, std::micro> prepare_time{ 0 };
+};
+
+// one statement cache per open connection; the registry itself is shared between threads
+std::mutex statement_caches_mutex;
+std::unordered_map<sqlite3*, std::unique_ptr<statement_cache>> statement_caches;
+
+/**
+ * Returns the statement cache of connection `db`, creating it on first use.
+ */
+statement_cache& statement_cache_for(sqlite3* db) {
+    std::lock_guard<std::mutex> lock(statement_caches_mutex);
+    std::unique_ptr<statement_cache>& cache = statement_caches[db];
+    if (!cache) cache = std::make_unique<statement_cache>(db);
+    return *cache;
+}
+
+/**
+ * Finalizes the cached statements of `db`. Must be called before sqlite3_close, which refuses to close a connection
+ * that still has prepared statements.
+ */
+void release_statement_cache(sqlite3* db) {
+    std::lock_guard<std::mutex> lock(statement_caches_mutex);
+    statement_caches.erase(db);
+}
+
+/**
+ * Prints the hit ratio of the statement cache of `db` and the prepare time the hits saved.
+ */
+void report_statement_cache(sqlite3* db) {
+    const statement_cache& cache = statement_cache_for(db);
+    const size_t lookups = cache.hits() + cache.misses();
+    const double hit_ratio = lookups == 0 ? 0.0 : 100.0 * cache.hits() / lookups;
+    std::cout << std::endl << "Statement cache: " << cache.hits() << " hits, " << cache.misses() << " misses ("
+        << std::fixed << std::setprecision(1) << hit_ratio << "% hit ratio), average prepare "
+        << std::setprecision(2) << cache.average_prepare_time().count() << " us, about "
+        << cache.average_prepare_time().count() * cache.hits() / 1000.0 << " ms of preparing saved" << std::endl;
+}
+
+/**
+ * Works out the injection verdict of a statement the cache has just prepared, from SQLite's own parse of it: SQL left
+ * over in pzTail is a stacked statement, and the authorizer's record of the prepare must show no internal table reads,
+ * ATTACH, PRAGMA or dangerous function calls. Ordinary writes are allowed. The
+ * is_unsafe_query checks, which include folding the WHERE clause, run as well. Called once per cache entry; the entry
+ * keeps the verdict, so running the statement again costs no checking at all.
+ */
+statement_cache::verdict check_prepared_statement(const statement_cache::entry& cached) {
+    bool unsafe = is_unsafe_query(cached.sql);
+
+    const char* reason = NULL;
+    if (cached.statement == NULL) reason = "no statement";
+    else if (!cached.complete) reason = "more than one statement";
+    else if (cached.hazard != NULL) reason = cached.hazard;
+    if (reason != NULL) {
+        LOG_WARN("Prepared statement rejected: ", reason);
+        if (!unsafe) LOG_WARN("SQL INJECTION DETECTED WEE WOO WEE WOO PULL OVER");
+        unsafe = true;
+    }
+    return unsafe ? statement_cache::verdict::unsafe : statement_cache::verdict::safe;
+}
+
+/**
+ * Forward-only cursor over the rows of a prepared statement. Columns are read by type straight from the current row:
+ * integers without a text conversion and text as a view with its length from sqlite3_column_bytes. Views stay valid
+ * until the next call to next().
+ */
+class row_cursor {
+public:
+    explicit row_cursor(sqlite3_stmt* statement) : statement(statement), columns(sqlite3_column_count(statement)) {}
+
+    /**
+     * Steps to the next row. Returns false at the end of the rows or on an error; failed() tells the two apart.
+     */
+    bool next() {
+        const int result = sqlite3_step(statement);
+        error = result != SQLITE_ROW && result != SQLITE_DONE;
+        return result == SQLITE_ROW;
+    }
+
+    bool failed() const { return error; }
+    int column_count() const { return columns; }
+    int column_type(int column) const { return sqlite3_column_type(statement, column); }
+
+    sqlite3_int64 column_int64(int column) const { return sqlite3_column_int64(statement, column); }
+
+    std::string_view column_text(int column) const {
+        // sqlite3_column_text must come first so that sqlite3_column_bytes reports the length of the text form
+        const unsigned char* text = sqlite3_column_text(statement, column);
+        return text ? std::string_view(reinterpret_cast<const char*>(text), sqlite3_column_bytes(statement, column)) : std::string_view();
+    }
+
+private:
+    sqlite3_stmt* statement;
+    int columns;
+    bool error = false;
+};
+
+/**
+ * Reads a column as the text callback would see it. Integers are formatted here with to_chars, which is cheaper than
+ * having SQLite convert them and keep a text copy. Columns known to hold text skip the type check.
+ */
+std::string column_as_string(const row_cursor& cursor, int column, bool maybe_integer) {
+    if (column >= cursor.column_count()) return std::string();
+    if (maybe_integer && cursor.column_type(column) == SQLITE_INTEGER) {
+        char digits[24];
+        const auto converted = std::to_chars(std::begin(digits), std::end(digits), cursor.column_int64(column));
+        return std::string(digits, converted.ptr);
+    }
+    return std::string(cursor.column_text(column));
+}
+
+/**
+ * Appends every row `statement` produces to `records` the way callback does. Returns false if stepping fails.
+ */
+bool collect_records(sqlite3_stmt* statement, std::vector< user_record >& records) {
+    row_cursor cursor(statement);
+    while (cursor.next()) {
+        // user_record is (ID, NAME, PASSWORD); only the ID column is expected to be an integer
+        records.emplace_back(column_as_string(cursor, 0, true), column_as_string(cursor, 1, false), column_as_string(cursor, 2, false));
+    }
+    return !cursor.failed();
+}
+
+/**
+ * Typed parameter binding for query(). Text is bound without copying, which is safe because the arguments outlive the
+ * statement's use within the call.
+ */
+template <std::integral Integer>
+int bind_parameter(sqlite3_stmt* statement, int index, Integer value) {
+    return sqlite3_bind_int64(statement, index, static_cast<sqlite3_int64>(value));
+}
+
+int bind_parameter(sqlite3_stmt* statement, int index, double value) {
+    return sqlite3_bind_double(statement, index, value);
+}
+
+int bind_parameter(sqlite3_stmt* statement, int index, std::string_view value) {
+    return sqlite3_bind_text(statement, index, value.data(), static_cast<int>(value.size()), SQLITE_STATIC);
+}
+
+int bind_parameter(sqlite3_stmt* statement, int index, const std::string& value) {
+    return bind_parameter(statement, index, std::string_view(value));
+}
+
+int bind_parameter(sqlite3_stmt* statement, int index, const char* value) {
+    return bind_parameter(statement, index, std::string_view(value));
+}
+
+int bind_parameter(sqlite3_stmt* statement, int index, std::nullptr_t) {
+    return sqlite3_bind_null(statement, index);
+}
+
+/**
+ * Front half of the parameterized query functions: takes the cached statement for `sql`, checks the SQL text for
+ * injection once per distinct text, and binds each argument to the next `?` in order. Bound values are never parsed as
+ * SQL, so they are never scanned. Prints why and returns NULL if the query must not run; otherwise pair with
+ * finish_query once the rows have been read.
+ */
+template <typename... Args>
+sqlite3_stmt* start_query(sqlite3* db, const std::string& sql, const Args&... args) {
+    statement_cache::entry* cached = statement_cache_for(db).acquire(sql);
+    if (cached == NULL || !cached->complete) {
+        LOG_ERROR("Failed to prepare parameterized query. ERROR = ", cached ? "more than one statement" :
+            sqlite3_errcode(db) == SQLITE_OK ? "no statement" : sqlite3_errmsg(db));
+        return NULL;
+    }
+
+    if (cached->check == statement_cache::verdict::unchecked) cached->check = check_prepared_statement(*cached);
+    if (cached->check == statement_cache::verdict::unsafe) return NULL;
+
+    if (sqlite3_bind_parameter_count(cached->statement) != static_cast<int>(sizeof...(args))) {
+        LOG_ERROR("Parameterized query expects ", sqlite3_bind_parameter_count(cached->statement), " values, got ", sizeof...(args));
+        return NULL;
+    }
+
+    int index = 0;
+    if (!((bind_parameter(cached->statement, ++index, args) == SQLITE_OK) && ...)) {
+        LOG_ERROR("Failed to bind query parameters. ERROR = ", sqlite3_errmsg(db));
+        sqlite3_clear_bindings(cached->statement);
+        return NULL;
+    }
+    return cached->statement;
+}
+
+/**
+ * Back half of the parameterized query functions: resets the statement and drops the bindings, since they point into
+ * the caller's arguments.
+ */
+void finish_query(sqlite3_stmt* statement) {
+    sqlite3_reset(statement);
+    sqlite3_clear_bindings(statement);
+}
+
+/**
+ * Runs the parameterized statement `sql` with `args` bound and returns the rows as the same user_records that callback
+ * builds. Prints the error and returns no rows on failure.
+ */
+template <typename... Args>
+std::vector< user_record > query(sqlite3* db, const std::string& sql, const Args&... args) {
+    std::vector< user_record > records;
+    sqlite3_stmt* statement = start_query(db, sql, args...);
+    if (statement == NULL) return records;
+
+    if (!collect_records(statement, records)) {
+        LOG_ERROR("Data failed to be queried from USERS table. ERROR = ", sqlite3_errmsg(db));
+        records.clear();
+    }
+    finish_query(statement);
+    return records;
+}
+
+/**
+ * One USERS row viewed in place, without owning its text.
+ */
+struct user_row_view {
+    sqlite3_int64 id;
+    std::string_view name;
+    std::string_view password;
+
+    user_record to_record() const {
+        return user_record(std::to_string(id), std::string(name), std::string(password));
+    }
+};
+
+/**
+ * Columnar USERS result: IDs in one contiguous int64 array, and NAME and PASSWORD text packed into a single arena.
+ * Row i's name spans [name_offsets[i], password_offsets[i]) of the arena and its password runs from there up to
+ * name_offsets[i + 1]. A row costs 16 bytes plus its text, instead of three std::strings.
+ */
+class user_result_set {
+public:
+    size_t size() const { return id_column.size(); }
+    bool empty() const { return id_column.empty(); }
+
+    void clear() {
+        id_column.clear();
+        arena.clear();
+        name_offsets.assign(1, 0);
+        password_offsets.clear();
+    }
+
+    void reserve(size_t rows, size_t text_bytes) {
+        id_column.reserve(rows);
+        name_offsets.reserve(rows + 1);
+        password_offsets.reserve(rows);
+        arena.reserve(text_bytes);
+    }
+
+    void append(sqlite3_int64 id, std::string_view name, std::string_view password) {
+        assert(arena.size() + name.size() + password.size() <= UINT32_MAX);
+        id_column.push_back(id);
+        arena.append(name);
+        password_offsets.push_back(static_cast<uint32_t>(arena.size()));
+        arena.append(password);
+        name_offsets.push_back(static_cast<uint32_t>(arena.size()));
+    }
+
+    const std::vector<sqlite3_int64>& ids() const { return id_column; }
+
+    std::string_view name(size_t row) const {
+        return std::string_view(arena).substr(name_offsets[row], password_offsets[row] - name_offsets[row]);
+    }
+
+    std::string_view password(size_t row) const {
+        return std::string_view(arena).substr(password_offsets[row], name_offsets[row + 1] - password_offsets[row]);
+    }
+
+    user_row_view operator[](size_t row) const {
+        return user_row_view{ id_column[row], name(row), password(row) };
+    }
+
+    /**
+     * Copies the rows out as user_records for code that still expects them, such as dump_results.
+     */
+    std::vector< user_record > to_records() const {
+        std::vector< user_record > records;
+        records.reserve(size());
+        for (size_t row = 0; row < size(); ++row) records.push_back((*this)[row].to_record());
+        return records;
+    }
+
+    /**
+     * Bytes of memory held, counting reserved capacity.
+     */
+    size_t memory_bytes() const {
+        return id_column.capacity() * sizeof(sqlite3_int64) + arena.capacity()
+            + (name_offsets.capacity() + password_offsets.capacity()) * sizeof(uint32_t);
+    }
+
+private:
+    std::vector<sqlite3_int64> id_column;
+    std::string arena;
+    std::vector<uint32_t> name_offsets{ 0 };
+    std::vector<uint32_t> password_offsets;
+};
+
+/**
+ * Runs the parameterized statement `sql` with `args` bound and returns the rows as a columnar result set. Expects the
+ * (ID, NAME, PASSWORD) column order used throughout this file. Prints the error and returns no rows on failure.
+ */
+template <typename... Args>
+user_result_set query_columnar(sqlite3* db, const std::string& sql, const Args&... args) {
+    user_result_set results;
+    sqlite3_stmt* statement = start_query(db, sql, args...);
+    if (statement == NULL) return results;
+
+    row_cursor cursor(statement);
+    while (cursor.next()) {
+        results.append(cursor.column_int64(0), cursor.column_text(1), cursor.column_text(2));
+    }
+    if (cursor.failed()) {
+        LOG_ERROR("Data failed to be queried from USERS table. ERROR = ", sqlite3_errmsg(db));
+        results.clear();
+    }
+    finish_query(statement);
+    return results;
+}
+
+bool run_query(sqlite3* db, const std::string& sql, std::vector< user_record >& records)
+{
+    // clear any prior results
+    records.clear();
+
+    // one prepare serves both the injection checks and the execution
+    statement_cache::entry* cached = statement_cache_for(db).acquire(sql);
+    if (cached == NULL)
+    {
+        LOG_ERROR("Data failed to be queried from USERS table. ERROR = ", sqlite3_errcode(db) == SQLITE_OK ? "no statement" : sqlite3_errmsg(db));
+        return false;
+    }
+
+    if (cached->check == statement_cache::verdict::unchecked)
+    {
+        cached->check = check_prepared_statement(*cached);
+    }
+    else if (cached->check == statement_cache::verdict::unsafe)
+    {
+        LOG_WARN("Rejected query, already found unsafe: ", sql);
+    }
+    if (cached->check == statement_cache::verdict::unsafe) return false;
+
+    const bool succeeded = collect_records(cached->statement, records);
+    if (!succeeded)
+    {
+        LOG_ERROR("Data failed to be queried from USERS table. ERROR = ", sqlite3_errmsg(db));
+    }
+    sqlite3_reset(cached->statement);
+    return succeeded;
+}
+
+// DO NOT CHANGE
+bool run_query_injection(sqlite3* db, const std::string& sql, std::vector< user_record >& records)
+{
+    std::string injectedSQL(sql);
+    std::string localCopy(sql);
+
+    // we work on the local copy because of the const
+    std::transform(localCopy.begin(), localCopy.end(), localCopy.begin(), ::tolower);
+    if (localCopy.find_last_of(str_where) >= 0)
+    { // this sql has a where clause
+        if (localCopy.back() == ';')
+        { // smart SQL developer terminated with a semicolon - we can fix that!
+            injectedSQL.pop_back();
+        }
+
+        switch (rand() % 4)
+        {
+        case 1:
+            injectedSQL.append(" or 2=2;");
+            break;
+        case 2:
+            injectedSQL.append(" or 'hi'='hi';");
+            break;
+        case 3:
+            injectedSQL.append(" or 'hack'='hack';");
+            break;
+        case 0:
+        default:
+            injectedSQL.append(" or 1=1;");
+            break;
+        }
+    }
+
+    return run_query(db, injectedSQL, records);
+}
+
+
+// DO NOT CHANGE
+void dump_results(const std::string& sql, const std::vector< user_record >& records)
+{
+    std::cout << std::endl << "SQL: " << sql << " ==> " << records.size() << " records found." << std::endl;
+
+    for (auto record : records)
+    {
+        std::cout << "User: " << std::get<1>(record) << " [UID=" << std::get<0>(record) << " PWD=" << std::get<2>(record) << "]" << std::endl;
+    }
+}
+
+// DO NOT CHANGE
+void run_queries(sqlite3* db)
+{
+    char* error_message = NULL;
+
+    std::vector< user_record > records;
+
+    // query all
+    std::string sql = "SELECT * from USERS";
+    if (!run_query(db, sql, records)) return;
+    dump_results(sql, records);
+
+    //  query 1
+    sql = "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'";
+    if (!run_query(db, sql, records)) return;
+    dump_results(sql, records);
+
+    //  run query 1 with injection 5 times
+    for (auto i = 0; i < 5; ++i)
+    {
+        if (!run_query_injection(db, sql, records)) continue;
+        dump_results(sql, records);
+    }
+
+}
+
+/**
+ * Position-keyed transform, the same scheme as encrypt_decrypt in m5_encryption.cpp: the byte at file offset `offset + i`
+ * is xored with the key byte at that position modulo the key length, so any page can be transformed on its own.
+ */
+void encrypt_decrypt_at(char* data, size_t length, const std::string& key, sqlite3_int64 offset) {
+    size_t key_index = static_cast<size_t>(offset % static_cast<sqlite3_int64>(key.length()));
+    for (size_t i = 0; i < length; ++i) {
+        data[i] ^= key[key_index];
+        if (++key_index == key.length()) key_index = 0;
+    }
+}
+
+/**
+ * State shared by every file opened through an encrypting VFS: the VFS it wraps and the key pages are encrypted with.
+ */
+struct encrypted_vfs_data {
+    sqlite3_vfs vfs;
+    sqlite3_vfs* real;
+    std::string name;
+    std::string key;
+};
+
+/**
+ * A file opened through the encrypting VFS. SQLite allocates szOsFile bytes for it, so the wrapped file lives directly
+ * after this struct in the same allocation.
+ */
+struct encrypted_file {
+    sqlite3_file base; // must be first so SQLite can treat this as a sqlite3_file
+    const encrypted_vfs_data* vfs;
+    std::vector<char> scratch; // reused buffer for encrypting pages on their way to disk
+
+    sqlite3_file* real() { return reinterpret_cast<sqlite3_file*>(this + 1); }
+};
+
+encrypted_file* as_encrypted(sqlite3_file* file) {
+    return reinterpret_cast<encrypted_file*>(file);
+}
+
+int encrypted_close(sqlite3_file* file) {
+    encrypted_file* self = as_encrypted(file);
+    int result = self->real()->pMethods ? self->real()->pMethods->xClose(self->real()) : SQLITE_OK;
+    self->~encrypted_file();
+    return result;
+}
+
+/**
+ * Reads pass through and are decrypted in place in SQLite's own page buffer.
+ */
+int encrypted_read(sqlite3_file* file, void* buffer, int amount, sqlite3_int64 offset) {
+    encrypted_file* self = as_encrypted(file);
+    int result = self->real()->pMethods->xRead(self->real(), buffer, amount, offset);
+    size_t valid = static_cast<size_t>(amount);
+    if (result == SQLITE_IOERR_SHORT_READ) {
+        // the tail past end of file was zero filled and must stay zero, so only decrypt what was really read
+        sqlite3_int64 size = 0;
+        if (self->real()->pMethods->xFileSize(self->real(), &size) != SQLITE_OK) return SQLITE_IOERR_READ;
+        valid = static_cast<size_t>(std::clamp<sqlite3_int64>(size - offset, 0, amount));
+    }
+    else if (result != SQLITE_OK) {
+        return result;
+    }
+    encrypt_decrypt_at(static_cast<char*>(buffer), valid, self->vfs->key, offset);
+    return result;
+}
+
+/**
+ * Writes are encrypted into a page-sized scratch buffer, since the caller's page must stay plaintext in the page cache.
+ */
+int encrypted_write(sqlite3_file* file, const void* buffer, int amount, sqlite3_int64 offset) {
+    encrypted_file* self = as_encrypted(file);
+    if (self->scratch.size() < static_cast<size_t>(amount)) self->scratch.resize(amount);
+    std::memcpy(self->scratch.data(), buffer, amount);
+    encrypt_decrypt_at(self->scratch.data(), amount, self->vfs->key, offset);
+    return self->real()->pMethods->xWrite(self->real(), self->scratch.data(), amount, offset);
+}
+
+int encrypted_fetch(sqlite3_file*, sqlite3_int64, int, void** pointer) {
+    // memory-mapped pages would expose ciphertext to SQLite, so always make it fall back to xRead
+    *pointer = nullptr;
+    return SQLITE_OK;
+}
+
+int encrypted_unfetch(sqlite3_file*, sqlite3_int64, void*) {
+    return SQLITE_OK;
+}
+
+// everything else is forwarded unchanged to the wrapped file
+int encrypted_truncate(sqlite3_file* f, sqlite3_int64 size) { return as_encrypted(f)->real()->pMethods->xTruncate(as_encrypted(f)->real(), size); }
+int encrypted_sync(sqlite3_file* f, int flags) { return as_encrypted(f)->real()->pMethods->xSync(as_encrypted(f)->real(), flags); }
+int encrypted_file_size(sqlite3_file* f, sqlite3_int64* size) { return as_encrypted(f)->real()->pMethods->xFileSize(as_encrypted(f)->real(), size); }
+int encrypted_lock(sqlite3_file* f, int lock) { return as_encrypted(f)->real()->pMethods->xLock(as_encrypted(f)->real(), lock); }
+int encrypted_unlock(sqlite3_file* f, int lock) { return as_encrypted(f)->real()->pMethods->xUnlock(as_encrypted(f)->real(), lock); }
+int encrypted_check_reserved_lock(sqlite3_file* f, int* out) { return as_encrypted(f)->real()->pMethods->xCheckReservedLock(as_encrypted(f)->real(), out); }
+int encrypted_file_control(sqlite3_file* f, int op, void* arg) { return as_encrypted(f)->real()->pMethods->xFileControl(as_encrypted(f)->real(), op, arg); }
+int encrypted_sector_size(sqlite3_file* f) { return as_encrypted(f)->real()->pMethods->xSectorSize(as_encrypted(f)->real()); }
+int encrypted_device_characteristics(sqlite3_file* f) { return as_encrypted(f)->real()->pMethods->xDeviceCharacteristics(as_encrypted(f)->real()); }
+int encrypted_shm_map(sqlite3_file* f, int page, int size, int extend, void volatile** out) { return as_encrypted(f)->real()->pMethods->xShmMap(as_encrypted(f)->real(), page, size, extend, out); }
+int encrypted_shm_lock(sqlite3_file* f, int offset, int n, int flags) { return as_encrypted(f)->real()->pMethods->xShmLock(as_encrypted(f)->real(), offset, n, flags); }
+void encrypted_shm_barrier(sqlite3_file* f) { as_encrypted(f)->real()->pMethods->xShmBarrier(as_encrypted(f)->real()); }
+int encrypted_shm_unmap(sqlite3_file* f, int delete_flag) { return as_encrypted(f)->real()->pMethods->xShmUnmap(as_encrypted(f)->real(), delete_flag); }
+
+const sqlite3_io_methods encrypted_io_methods = {
+    3,
+    encrypted_close,
+    encrypted_read,
+    encrypted_write,
+    encrypted_truncate,
+    encrypted_sync,
+    encrypted_file_size,
+    encrypted_lock,
+    encrypted_unlock,
+    encrypted_check_reserved_lock,
+    encrypted_file_control,
+    encrypted_sector_size,
+    encrypted_device_characteristics,
+    encrypted_shm_map,
+    encrypted_shm_lock,
+    encrypted_shm_barrier,
+    encrypted_shm_unmap,
+    encrypted_fetch,
+    encrypted_unfetch,
+};
+
+/**
+ * Opens the real file and wraps it. Database, rollback journal, WAL and temporary files all go through here, so every
+ * page that reaches the disk is encrypted. The -shm index is only ever memory mapped and holds no row data.
+ */
+int encrypted_open(sqlite3_vfs* vfs, const char* name, sqlite3_file* file, int flags, int* out_flags) {
+    const encrypted_vfs_data* data = static_cast<const encrypted_vfs_data*>(vfs->pAppData);
+    encrypted_file* self = new (file) encrypted_file{ { nullptr }, data, {} };
+    std::memset(self->real(), 0, data->real->szOsFile);
+
+    int result = data->real->xOpen(data->real, name, self->real(), flags, out_flags);
+    // SQLite calls xClose whenever pMethods is set, even if the open failed
+    self->base.pMethods = &encrypted_io_methods;
+    return result;
+}
+
+int encrypted_delete(sqlite3_vfs* v, const char* name, int sync_dir) { sqlite3_vfs* r = static_cast<encrypted_vfs_data*>(v->pAppData)->real; return r->xDelete(r, name, sync_dir); }
+int encrypted_access(sqlite3_vfs* v, const char* name, int flags, int* out) { sqlite3_vfs* r = static_cast<encrypted_vfs_data*>(v->pAppData)->real; return r->xAccess(r, name, flags, out); }
+int encrypted_full_pathname(sqlite3_vfs* v, const char* name, int size, char* out) { sqlite3_vfs* r = static_cast<encrypted_vfs_data*>(v->pAppData)->real; return r->xFullPathname(r, name, size, out); }
+void* encrypted_dl_open(sqlite3_vfs* v, const char* name) { sqlite3_vfs* r = static_cast<encrypted_vfs_data*>(v->pAppData)->real; return r->xDlOpen(r, name); }
+void encrypted_dl_error(sqlite3_vfs* v, int size, char* out) { sqlite3_vfs* r = static_cast<encrypted_vfs_data*>(v->pAppData)->real; r->xDlError(r, size, out); }
+void (*encrypted_dl_sym(sqlite3_vfs* v, void* handle, const char* symbol))(void) { sqlite3_vfs* r = static_cast<encrypted_vfs_data*>(v->pAppData)->real; return r->xDlSym(r, handle, symbol); }
+void encrypted_dl_close(sqlite3_vfs* v, void* handle) { sqlite3_vfs* r = static_cast<encrypted_vfs_data*>(v->pAppData)->real; r->xDlClose(r, handle); }
+int encrypted_randomness(sqlite3_vfs* v, int size, char* out) { sqlite3_vfs* r = static_cast<encrypted_vfs_data*>(v->pAppData)->real; return r->xRandomness(r, size, out); }
+int encrypted_sleep(sqlite3_vfs* v, int microseconds) { sqlite3_vfs* r = static_cast<encrypted_vfs_data*>(v->pAppData)->real; return r->xSleep(r, microseconds); }
+int encrypted_current_time(sqlite3_vfs* v, double* out) { sqlite3_vfs* r = static_cast<encrypted_vfs_data*>(v->pAppData)->real; return r->xCurrentTime(r, out); }
+int encrypted_get_last_error(sqlite3_vfs* v, int size, char* out) { sqlite3_vfs* r = static_cast<encrypted_vfs_data*>(v->pAppData)->real; return r->xGetLastError ? r->xGetLastError(r, size, out) : 0; }
+int encrypted_current_time_int64(sqlite3_vfs* v, sqlite3_int64* out) { sqlite3_vfs* r = static_cast<encrypted_vfs_data*>(v->pAppData)->real; return r->xCurrentTimeInt64(r, out); }
+
+/**
+ * Registers a VFS named `name` that encrypts every page written through the default VFS with `key`. Open a database
+ * with it by passing `name` to sqlite3_open_v2. Registering the same name and key again is a no-op. Returns false if the
+ * VFS could not be registered, or if `name` is already taken by another VFS or by this one with a different key.
+ */
+bool register_encrypted_vfs(const std::string& name, const std::string& key) {
+    if (key.empty()) return false;
+    if (const sqlite3_vfs* existing = sqlite3_vfs_find(name.c_str())) {
+        return existing->xOpen == encrypted_open && static_cast<const encrypted_vfs_data*>(existing->pAppData)->key == key;
+    }
+
+    sqlite3_vfs* real = sqlite3_vfs_find(NULL);
+    if (real == NULL || real->iVersion < 2) return false;
+
+    // registered VFSes must outlive every connection, so this is intentionally never freed
+    encrypted_vfs_data* data = new encrypted_vfs_data{ {}, real, name, key };
+    sqlite3_vfs& vfs = data->vfs;
+    vfs.iVersion = 2;
+    vfs.szOsFile = static_cast<int>(sizeof(encrypted_file)) + real->szOsFile;
+    vfs.mxPathname = real->mxPathname;
+    vfs.zName = data->name.c_str();
+    vfs.pAppData = data;
+    vfs.xOpen = encrypted_open;
+    vfs.xDelete = encrypted_delete;
+    vfs.xAccess = encrypted_access;
+    vfs.xFullPathname = encrypted_full_pathname;
+    vfs.xDlOpen = encrypted_dl_open;
+    vfs.xDlError = encrypted_dl_error;
+    vfs.xDlSym = encrypted_dl_sym;
+    vfs.xDlClose = encrypted_dl_close;
+    vfs.xRandomness = encrypted_randomness;
+    vfs.xSleep = encrypted_sleep;
+    vfs.xCurrentTime = encrypted_current_time;
+    vfs.xGetLastError = encrypted_get_last_error;
+    vfs.xCurrentTimeInt64 = encrypted_current_time_int64;
+
+    return sqlite3_vfs_register(&vfs, 0) == SQLITE_OK;
+}
+
+/**
+ * Tuning for bulk_load_users.
+ */
+struct bulk_load_options {
+    int batch_rows = 50000;    // rows per transaction
+    bool fast_pragmas = true;  // journal_mode=MEMORY and synchronous=OFF while loading, restored afterwards
+};
+
+/**
+ * Reads one PRAGMA's current value as text, e.g. "wal" for journal_mode or "2" for synchronous.
+ */
+std::string read_pragma(sqlite3* db, const char* pragma) {
+    const std::string sql = std::string("PRAGMA ") + pragma;
+    sqlite3_stmt* statement = NULL;
+    std::string value;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &statement, NULL) == SQLITE_OK && sqlite3_step(statement) == SQLITE_ROW) {
+        const unsigned char* text = sqlite3_column_text(statement, 0);
+        if (text != NULL) value = reinterpret_cast<const char*>(text);
+    }
+    sqlite3_finalize(statement);
+    return value;
+}
+
+/**
+ * Inserts `row_count` USERS rows, taking row i from `next_row(i)`, which returns a user_row_view whose text must stay
+ * valid until the following call. One INSERT is prepared and rebound for every row, and the rows are committed every
+ * `options.batch_rows` inside explicit transactions, so nothing is parsed per row and the journal is synced once per
+ * batch instead of once per row. With `options.fast_pragmas` the rollback journal is kept in memory rather than in a
+ * file (a WAL database keeps its WAL) and syncing is switched off for the load, and the previous journal_mode and
+ * synchronous settings are restored afterwards. A failed batch still rolls back cleanly, but a crash or power loss part
+ * way through the load can corrupt the database. If a transaction is already open the rows join it and the caller
+ * keeps control of transactions and pragmas. Returns false, rolling back the current batch, if a row fails to insert
+ * or a BEGIN, COMMIT or PRAGMA fails.
+ */
+template <typename RowSource>
+bool bulk_load_users(sqlite3* db, size_t row_count, RowSource&& next_row, const bulk_load_options& options = {}) {
+    // runs a statement that returns nothing useful, logging it if it fails
+    auto run = [db](const std::string& sql) {
+        if (sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL) == SQLITE_OK) return true;
+        LOG_ERROR("Bulk load of USERS failed on ", sql, ". ERROR = ", sqlite3_errmsg(db));
+        return false;
+    };
+
+    const bool own_transactions = sqlite3_get_autocommit(db) != 0;
+    const bool fast_pragmas = own_transactions && options.fast_pragmas;
+    bool succeeded = true;
+    std::string journal_mode, synchronous;
+    if (fast_pragmas) {
+        journal_mode = read_pragma(db, "journal_mode");
+        synchronous = read_pragma(db, "synchronous");
+        if (journal_mode.empty() || synchronous.empty()) {
+            LOG_ERROR("Bulk load of USERS failed to read journal_mode and synchronous. ERROR = ", sqlite3_errmsg(db));
+            return false;
+        }
+        succeeded = (journal_mode == "wal" || run("PRAGMA journal_mode=MEMORY")) && run("PRAGMA synchronous=OFF");
+    }
+
+    sqlite3_stmt* insert = NULL;
+    if (succeeded && sqlite3_prepare_v2(db, "INSERT INTO USERS (ID, NAME, PASSWORD) VALUES (?, ?, ?)", -1, &insert, NULL) != SQLITE_OK) {
+        LOG_ERROR("Bulk load of USERS failed. ERROR = ", sqlite3_errmsg(db));
+        succeeded = false;
+    }
+    const size_t batch_rows = static_cast<size_t>(std::max(1, options.batch_rows));
+    for (size_t i = 0; succeeded && i < row_count; ++i) {
+        if (own_transactions && i % batch_rows == 0) {
+            succeeded = (i == 0 || run("COMMIT")) && run("BEGIN");
+            if (!succeeded) break;
+        }
+        const user_row_view row = next_row(i);
+        sqlite3_bind_int64(insert, 1, row.id);
+        sqlite3_bind_text(insert, 2, row.name.data(), static_cast<int>(row.name.size()), SQLITE_STATIC);
+        sqlite3_bind_text(insert, 3, row.password.data(), static_cast<int>(row.password.size()), SQLITE_STATIC);
+        succeeded = sqlite3_step(insert) == SQLITE_DONE;
+        if (!succeeded) {
+            LOG_ERROR("Bulk load of USERS failed. ERROR = ", sqlite3_errmsg(db));
+        }
+        sqlite3_reset(insert);
+    }
+    sqlite3_finalize(insert);
+
+    if (own_transactions) {
+        // a COMMIT that fails leaves the transaction open, so it is rolled back as well
+        if (sqlite3_get_autocommit(db) == 0 && succeeded) succeeded = run("COMMIT");
+        if (sqlite3_get_autocommit(db) == 0) run("ROLLBACK");
+        if (fast_pragmas) {
+            succeeded = run("PRAGMA journal_mode=" + journal_mode) && succeeded;
+            succeeded = run("PRAGMA synchronous=" + synchronous) && succeeded;
+        }
+    }
+    return succeeded;
+}
+
+/**
+ * Storage layout for USERS. `rowid` is the layout initialize_database creates: rows live in a rowid b-tree and
+ * ID INT PRIMARY KEY is a separate unique index. `without_rowid` clusters the rows on ID itself, so there is one
+ * b-tree less and secondary indexes carry ID as their row key.
+ */
+enum class users_layout { rowid, without_rowid };
+
+/**
+ * Creates the USERS table with the schema from initialize_database in the given layout.
+ */
+bool create_users_table(sqlite3* db, users_layout layout) {
+    std::string sql = "CREATE TABLE USERS(ID INT PRIMARY KEY NOT NULL, NAME TEXT NOT NULL, PASSWORD TEXT NOT NULL)";
+    if (layout == users_layout::without_rowid) sql += " WITHOUT ROWID";
+    return sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL) == SQLITE_OK;
+}
+
+/**
+ * Name of the index created by index_users_table.
+ */
+constexpr const char* users_name_index = "USERS_NAME_COVERING";
+
+/**
+ * Adds a covering index for name lookups to USERS and refreshes the planner statistics. The index is on
+ * (NAME, PASSWORD, ID), so SELECT ID, NAME, PASSWORD ... WHERE NAME=? is answered from the index alone without
+ * visiting the table. ANALYZE runs with an analysis_limit so it stays quick on large tables; the connection's own
+ * analysis_limit is restored afterwards.
+ */
+bool index_users_table(sqlite3* db) {
+    const std::string analysis_limit = read_pragma(db, "analysis_limit");
+    const std::string sql = std::string("CREATE INDEX IF NOT EXISTS ") + users_name_index + " ON USERS(NAME, PASSWORD, ID);"
+        "PRAGMA analysis_limit=1000;"
+        "ANALYZE USERS;";
+    char* error_message = NULL;
+    const bool indexed = sqlite3_exec(db, sql.c_str(), NULL, NULL, &error_message) == SQLITE_OK;
+    if (!indexed) {
+        LOG_ERROR("Failed to index USERS. ERROR = ", error_message ? error_message : sqlite3_errmsg(db));
+        sqlite3_free(error_message);
+    }
+    if (!analysis_limit.empty()) {
+        const std::string restore = "PRAGMA analysis_limit=" + analysis_limit;
+        sqlite3_exec(db, restore.c_str(), NULL, NULL, NULL);
+    }
+    return indexed;
+}
+
+/**
+ * Returns the EXPLAIN QUERY PLAN details of `sql`, one step per line.
+ */
+std::string explain_query_plan(sqlite3* db, const std::string& sql) {
+    const std::string explain = "EXPLAIN QUERY PLAN " + sql;
+    sqlite3_stmt* statement = NULL;
+    std::string plan;
+    if (sqlite3_prepare_v2(db, explain.c_str(), -1, &statement, NULL) != SQLITE_OK) return plan;
+    while (sqlite3_step(statement) == SQLITE_ROW) {
+        // the columns are id, parent, notused and detail
+        const unsigned char* detail = sqlite3_column_text(statement, 3);
+        if (detail == NULL) continue;
+        if (!plan.empty()) plan += '\n';
+        plan += reinterpret_cast<const char*>(detail);
+    }
+    sqlite3_finalize(statement);
+    return plan;
+}
+
+/**
+ * Checks with EXPLAIN QUERY PLAN that the name lookups run_queries and the parameterized API issue are answered from
+ * the covering index rather than a table scan. Logs the plan of any lookup that is not and returns false.
+ */
+bool check_users_query_plans(sqlite3* db) {
+    static const char* const hot_lookups[] = {
+        "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'",
+        "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME=?",
+    };
+    const std::string expected = std::string("USING COVERING INDEX ") + users_name_index;
+    bool indexed = true;
+    for (const char* sql : hot_lookups) {
+        const std::string plan = explain_query_plan(db, sql);
+        if (plan.find(expected) == std::string::npos) {
+            LOG_ERROR("Lookup does not use ", users_name_index, ": ", sql, " PLAN: ", plan);
+            indexed = false;
+        }
+    }
+    return indexed;
+}
+
+/**
+ * Writes the whole of the main database of `db` to `path` as a database image from sqlite3_serialize, the same bytes
+ * a database file would hold. The image goes to a temporary file that is renamed over `path` once complete, replacing
+ * any earlier image, so a failed save never leaves a truncated image behind.
+ */
+bool save_database_image(sqlite3* db, const std::string& path) {
+    sqlite3_int64 size = 0;
+    unsigned char* image = sqlite3_serialize(db, "main", &size, 0);
+    if (image == NULL) {
+        LOG_ERROR("Failed to serialize the database. ERROR = ", sqlite3_errmsg(db));
+        return false;
+    }
+
+    const std::string temporary = path + ".tmp";
+    FILE* file = std::fopen(temporary.c_str(), "wb");
+    bool saved = file != NULL && std::fwrite(image, 1, static_cast<size_t>(size), file) == static_cast<size_t>(size);
+    if (file != NULL) saved = std::fclose(file) == 0 && saved;
+    sqlite3_free(image);
+    // std::rename fails on Windows when `path` exists; std::filesystem::rename replaces it everywhere
+    std::error_code error;
+    if (saved) std::filesystem::rename(temporary, path, error);
+    saved = saved && !error;
+    if (!saved) {
+        LOG_ERROR("Failed to write the database image to ", path);
+        std::remove(temporary.c_str());
+    }
+    return saved;
+}
+
+/**
+ * Replaces the main database of `db`, which should be a fresh ":memory:" connection, with the image saved at `path` by
+ * save_database_image. The image is read into one SQLite allocation that the connection takes over and frees when it
+ * closes; it can still grow with writes unless `read_only` is set. Only the header is checked here, so a damaged image
+ * shows up as SQLITE_CORRUPT on a later query.
+ */
+bool load_database_image(sqlite3* db, const std::string& path, bool read_only = false) {
+    // std::ftell returns a 32-bit long on Windows, so the size comes from the file system instead
+    std::error_code error;
+    const std::uintmax_t file_size = std::filesystem::file_size(path, error);
+    FILE* file = error ? NULL : std::fopen(path.c_str(), "rb");
+    if (file == NULL) {
+        LOG_ERROR("Failed to open the database image ", path);
+        return false;
+    }
+    // sqlite3_deserialize takes a signed 64-bit size and fread a size_t
+    if (file_size > static_cast<std::uintmax_t>(std::min<sqlite3_uint64>(SIZE_MAX, INT64_MAX))) {
+        LOG_ERROR("Database image too large to load: ", path);
+        std::fclose(file);
+        return false;
+    }
+    const sqlite3_int64 size = static_cast<sqlite3_int64>(file_size);
+
+    static constexpr char header[] = "SQLite format 3";
+    unsigned char* image = size >= 100 ? static_cast<unsigned char*>(sqlite3_malloc64(static_cast<sqlite3_uint64>(size))) : NULL;
+    const bool read = image != NULL && std::fread(image, 1, static_cast<size_t>(size), file) == static_cast<size_t>(size);
+    std::fclose(file);
+    if (!read || std::memcmp(image, header, sizeof(header)) != 0) {
+        LOG_ERROR("Not a database image: ", path);
+        sqlite3_free(image);
+        return false;
+    }
+
+    // with FREEONCLOSE SQLite frees the image itself, even when sqlite3_deserialize fails
+    const unsigned flags = SQLITE_DESERIALIZE_FREEONCLOSE | (read_only ? SQLITE_DESERIALIZE_READONLY : SQLITE_DESERIALIZE_RESIZEABLE);
+    if (sqlite3_deserialize(db, "main", image, size, size, flags) != SQLITE_OK) {
+        LOG_ERROR("Failed to load the database image ", path, ". ERROR = ", sqlite3_errmsg(db));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * File-backed connection pool in WAL mode: one writer connection and a set of read-only connections, all opened with
+ * SQLITE_OPEN_NOMUTEX. A connection is only ever used by the thread holding its lease, so SQLite's per-connection
+ * mutex is not needed, and with WAL the readers see the last committed state without blocking the writer or each
+ * other. Size the readers to the number of worker threads. Time spent waiting for a connection is tracked.
+ */
+class connection_pool {
+public:
+    /**
+     * Exclusive use of one pooled connection, handed back to the pool when the lease is destroyed. Statements taken
+     * from statement_cache_for(lease.get()) may be used while the lease is held.
+     */
+    class lease {
+    public:
+        lease() = default;
+        lease(lease&& other) noexcept : pool(std::exchange(other.pool, nullptr)), db(std::exchange(other.db, nullptr)) {}
+        lease& operator=(lease&& other) noexcept {
+            if (this != &other) {
+                release();
+                pool = std::exchange(other.pool, nullptr);
+                db = std::exchange(other.db, nullptr);
+            }
+            return *this;
+        }
+        ~lease() { release(); }
+
+        sqlite3* get() const { return db; }
+        explicit operator bool() const { return db != nullptr; }
+
+    private:
+        friend class connection_pool;
+        lease(connection_pool* pool, sqlite3* db) : pool(pool), db(db) {}
+
+        void release() {
+            if (pool != nullptr) pool->give_back(db);
+            pool = nullptr;
+            db = nullptr;
+        }
+
+        connection_pool* pool = nullptr;
+        sqlite3* db = nullptr;
+    };
+
+    connection_pool(const std::string& path, size_t reader_count) {
+        if (!open_connection(path, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, &writer) ||
+            sqlite3_exec(writer, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;", NULL, NULL, NULL) != SQLITE_OK) {
+            return;
+        }
+        for (size_t i = 0; i < reader_count; ++i) {
+            sqlite3* reader = NULL;
+            if (!open_connection(path, SQLITE_OPEN_READONLY, &reader)) return;
+            readers.push_back(reader);
+        }
+        idle_readers = readers;
+        writer_idle = true;
+        opened = true;
+    }
+
+    ~connection_pool() {
+        for (sqlite3* reader : readers) close_connection(reader);
+        close_connection(writer);
+    }
+
+    connection_pool(const connection_pool&) = delete;
+    connection_pool& operator=(const connection_pool&) = delete;
+
+    bool is_open() const { return opened; }
+
+    /**
+     * Leases a read-only connection, waiting for one to come free.
+     */
+    lease read() {
+        const auto start = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mutex);
+        available.wait(lock, [this]() { return !idle_readers.empty(); });
+        sqlite3* db = idle_readers.back();
+        idle_readers.pop_back();
+        record_wait(start);
+        return lease(this, db);
+    }
+
+    /**
+     * Leases the writer connection, waiting for any other writer to finish with it.
+     */
+    lease write() {
+        const auto start = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mutex);
+        available.wait(lock, [this]() { return writer_idle; });
+        writer_idle = false;
+        record_wait(start);
+        return lease(this, writer);
+    }
+
+    size_t reader_count() const { return readers.size(); }
+
+    size_t leases() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return lease_count;
+    }
+
+    /**
+     * Average and longest time a caller waited for a connection.
+     */
+    std::chrono::duration<double, std::micro> average_wait() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return lease_count == 0 ? std::chrono::duration<double, std::micro>(0) : total_wait / static_cast<double>(lease_count);
+    }
+
+    std::chrono::duration<double, std::micro> longest_wait() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return max_wait;
+    }
+
+private:
+    bool open_connection(const std::string& path, int flags, sqlite3** db) {
+        if (sqlite3_open_v2(path.c_str(), db, flags | SQLITE_OPEN_NOMUTEX, NULL) == SQLITE_OK) return true;
+        LOG_ERROR("Failed to open pooled connection to ", path, ". ERROR = ", sqlite3_errmsg(*db));
+        sqlite3_close(*db);
+        *db = NULL;
+        return false;
+    }
+
+    static void close_connection(sqlite3* db) {
+        if (db == NULL) return;
+        release_statement_cache(db);
+        sqlite3_close(db);
+    }
+
+    // called with the mutex held
+    void record_wait(std::chrono::steady_clock::time_point start) {
+        const std::chrono::duration<double, std::micro> waited = std::chrono::steady_clock::now() - start;
+        total_wait += waited;
+        max_wait = std::max(max_wait, waited);
+        ++lease_count;
+    }
+
+    void give_back(sqlite3* db) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (db == writer) writer_idle = true;
+            else idle_readers.push_back(db);
+        }
+        available.notify_all();
+    }
+
+    sqlite3* writer = NULL;
+    std::vector<sqlite3*> readers;
+    bool opened = false;
+
+    mutable std::mutex mutex;
+    std::condition_variable available;
+    std::vector<sqlite3*> idle_readers; // used as a stack, so recently used connections with warm caches go out first
+    bool writer_idle = false;
+    size_t lease_count = 0;
+    std::chrono::duration<double, std::micro> total_wait{ 0 };
+    std::chrono::duration<double, std::micro> max_wait{ 0 };
+};
+
+/**
+ * Outcome of a query run by query_executor. Failed covers both queries rejected by the injection checks and SQLite
+ * errors; the reason is in the log. Cancelled queries keep no rows.
+ */
+struct query_result {
+    enum class outcome { completed, failed, cancelled };
+
+    outcome status = outcome::completed;
+    std::vector< user_record > records;
+    std::chrono::duration<double, std::micro> queued{ 0 }; // from submit until a worker picked the query up
+    std::chrono::duration<double, std::micro> ran{ 0 };
+};
+
+/**
+ * Runs queries on a fixed set of worker threads, each holding one read connection leased from `pool` for as long as
+ * it lives. The pool must outlive the executor. A worker count above the pool's readers is cut down to the reader
+ * count, since the extra workers would wait for a connection forever; with no workers at all the executor is not
+ * open and every submitted query fails at once. Submitted queries wait in
+ * a bounded queue: submit blocks while the queue is full, which holds callers back to the rate the workers can keep
+ * up with. A query is cancelled through the stop_token given to submit; one still queued is dropped without running,
+ * and a running one is stopped by a progress handler that checks the token every 1000 virtual machine steps. The
+ * destructor lets the workers finish everything already queued.
+ */
+class query_executor {
+public:
+    query_executor(connection_pool& pool, size_t worker_count, size_t queue_capacity = 256) : capacity(std::max<size_t>(queue_capacity, 1)) {
+        if (worker_count > pool.reader_count()) {
+            LOG_WARN("Query executor asked for ", worker_count, " workers but the pool has ", pool.reader_count(), " readers");
+            worker_count = pool.reader_count();
+        }
+        if (!pool.is_open() || worker_count == 0) {
+            LOG_ERROR("Query executor has no connections to run queries on");
+            return;
+        }
+        for (size_t i = 0; i < worker_count; ++i) workers.emplace_back([this, &pool]() { run_worker(pool.read()); });
+    }
+
+    ~query_executor() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        job_ready.notify_all();
+        for (std::thread& worker : workers) worker.join();
+    }
+
+    query_executor(const query_executor&) = delete;
+    query_executor& operator=(const query_executor&) = delete;
+
+    bool is_open() const { return !workers.empty(); }
+    size_t worker_count() const { return workers.size(); }
+
+    /**
+     * Queues the statement `sql` with `args` bound to its `?` parameters in order, as query() does, and returns the
+     * future result. The arguments are copied into the queued job, except that views and pointers must stay valid
+     * until the future is ready.
+     */
+    template <typename... Args>
+    std::future<query_result> submit(std::stop_token cancel, std::string sql, Args... args) {
+        return enqueue(std::move(cancel), [sql = std::move(sql), values = std::make_tuple(std::move(args)...)](sqlite3* db, std::vector< user_record >& records) {
+            return std::apply([&](const auto&... bound) { return run_job(db, sql, records, bound...); }, values);
+        });
+    }
+
+    template <typename... Args>
+    std::future<query_result> submit(std::string sql, Args... args) {
+        return submit(std::stop_token(), std::move(sql), std::move(args)...);
+    }
+
+    /**
+     * Number of submit calls that had to wait for room in the queue.
+     */
+    size_t blocked_submissions() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return blocked_count;
+    }
+
+private:
+    struct job {
+        std::function<query_result::outcome(sqlite3*, std::vector< user_record >&)> work;
+        std::promise<query_result> promise;
+        std::stop_token cancel;
+        std::chrono::steady_clock::time_point submitted;
+    };
+
+    template <typename... Args>
+    static query_result::outcome run_job(sqlite3* db, const std::string& sql, std::vector< user_record >& records, const Args&... args) {
+        sqlite3_stmt* statement = start_query(db, sql, args...);
+        if (statement == NULL) return query_result::outcome::failed;
+
+        query_result::outcome status = query_result::outcome::completed;
+        if (!collect_records(statement, records)) {
+            records.clear();
+            if (sqlite3_errcode(db) == SQLITE_INTERRUPT) {
+                status = query_result::outcome::cancelled;
+            }
+            else {
+                LOG_ERROR("Data failed to be queried from USERS table. ERROR = ", sqlite3_errmsg(db));
+                status = query_result::outcome::failed;
+            }
+        }
+        finish_query(statement);
+        return status;
+    }
+
+    template <typename Work>
+    std::future<query_result> enqueue(std::stop_token cancel, Work&& work) {
+        job queued{ std::forward<Work>(work), std::promise<query_result>(), std::move(cancel), std::chrono::steady_clock::now() };
+        std::future<query_result> result = queued.promise.get_future();
+        if (!is_open()) {
+            queued.promise.set_value(query_result{ query_result::outcome::failed, {}, {}, {} });
+            return result;
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (jobs.size() >= capacity) ++blocked_count;
+            slot_free.wait(lock, [this]() { return jobs.size() < capacity; });
+            jobs.push_back(std::move(queued));
+        }
+        job_ready.notify_one();
+        return result;
+    }
+
+    // progress handler: a nonzero return makes the running statement fail with SQLITE_INTERRUPT
+    static int cancel_requested(void* cancel) {
+        return static_cast<const std::stop_token*>(cancel)->stop_requested() ? 1 : 0;
+    }
+
+    void run_worker(connection_pool::lease connection) {
+        sqlite3* db = connection.get();
+        for (;;) {
+            job next;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                job_ready.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                if (jobs.empty()) return;
+                next = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            slot_free.notify_one();
+
+            query_result result;
+            const auto start = std::chrono::steady_clock::now();
+            result.queued = start - next.submitted;
+            if (next.cancel.stop_requested()) {
+                result.status = query_result::outcome::cancelled;
+            }
+            else {
+                sqlite3_progress_handler(db, 1000, cancel_requested, &next.cancel);
+                result.status = next.work(db, result.records);
+                sqlite3_progress_handler(db, 0, NULL, NULL);
+            }
+            result.ran = std::chrono::steady_clock::now() - start;
+            next.promise.set_value(std::move(result));
+        }
+    }
+
+    const size_t capacity;
+    mutable std::mutex mutex;
+    std::condition_variable job_ready;
+    std::condition_variable slot_free;
+    std::deque<job> jobs;
+    bool stopping = false;
+    size_t blocked_count = 0;
+    std::vector<std::thread> workers;
+};
+
+/**
+ * Inserts USERS rows 1 to `row_count` for the benchmarks. Row 1 is Fred, so the run_queries lookup finds one row.
+ */
+void insert_sample_users(sqlite3* db, int row_count) {
+    std::string name;
+    bulk_load_users(db, static_cast<size_t>(std::max(0, row_count)), [&name](size_t i) {
+        const sqlite3_int64 id = static_cast<sqlite3_int64>(i) + 1;
+        name = id == 1 ? "Fred" : "user" + std::to_string(id);
+        return user_row_view{ id, name, "Flinstone" };
+    });
+}
+
+/**
+ * Times loading USERS and running the query mix from run_queries on a file database, through the default VFS and through
+ * the encrypting VFS. Warm runs reuse one connection and its page cache; cold runs reopen the database every time.
+ */
+int run_vfs_benchmark(int row_count, int iterations) {
+    const std::string key = "password";
+    const char* encrypted_vfs_name = "encrypted";
+    if (!register_encrypted_vfs(encrypted_vfs_name, key)) {
+        std::cout << "Failed to register the encrypting VFS." << std::endl;
+        return -1;
+    }
+
+    const std::vector<std::string> query_mix = {
+        "SELECT * from USERS",
+        "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'",
+    };
+
+    std::cout << std::endl << "VFS benchmark: " << row_count << " rows, " << iterations << " iterations of the query mix" << std::endl;
+
+    for (const char* vfs_name : { static_cast<const char*>(NULL), encrypted_vfs_name }) {
+        const std::string path = std::string("vfs_benchmark_") + (vfs_name ? vfs_name : "plain") + ".db";
+        std::remove(path.c_str());
+        std::remove((path + "-wal").c_str());
+        std::remove((path + "-shm").c_str());
+
+        const auto open = [&](sqlite3** db) {
+            return sqlite3_open_v2(path.c_str(), db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, vfs_name) == SQLITE_OK;
+        };
+        const auto run_mix = [&](sqlite3* db) {
+            std::vector< user_record > records;
+            for (const auto& sql : query_mix) {
+                records.clear();
+                sqlite3_exec(db, sql.c_str(), callback, &records, NULL);
+            }
+        };
+
+        sqlite3* db = NULL;
+        if (!open(&db)) {
+            std::cout << "Failed to open " << path << ": " << sqlite3_errmsg(db) << std::endl;
+            sqlite3_close(db);
+            return -1;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        sqlite3_exec(db, "PRAGMA journal_mode=WAL;"
+            "CREATE TABLE USERS(ID INT PRIMARY KEY NOT NULL, NAME TEXT NOT NULL, PASSWORD TEXT NOT NULL);"
+            "BEGIN;", NULL, NULL, NULL);
+        insert_sample_users(db, row_count);
+        sqlite3_exec(db, "COMMIT; PRAGMA wal_checkpoint(TRUNCATE);", NULL, NULL, NULL);
+        const std::chrono::duration<double, std::milli> load_time = std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) run_mix(db);
+        const std::chrono::duration<double, std::milli> warm_time = std::chrono::steady_clock::now() - start;
+        sqlite3_close(db);
+
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            if (open(&db)) run_mix(db);
+            sqlite3_close(db);
+        }
+        const std::chrono::duration<double, std::milli> cold_time = std::chrono::steady_clock::now() - start;
+
+        std::cout << (vfs_name ? "encrypted VFS" : "default VFS  ") << std::fixed << std::setprecision(2)
+            << "  load " << load_time.count() << " ms"
+            << "  warm mix " << warm_time.count() / iterations << " ms"
+            << "  cold mix " << cold_time.count() / iterations << " ms" << std::endl;
+
+        std::remove(path.c_str());
+        std::remove((path + "-wal").c_str());
+        std::remove((path + "-shm").c_str());
+    }
+
+    return 0;
+}
+
+/**
+ * Runs the run_queries query mix `iterations` times through sqlite3_exec and then through the statement cache, on a
+ * fresh copy of the example database, and reports the time per query and the cache statistics.
+ */
+int run_statement_cache_benchmark(int iterations) {
+    sqlite3* db = NULL;
+    if (sqlite3_open(":memory:", &db) != SQLITE_OK || !initialize_database(db)) {
+        sqlite3_close(db);
+        return -1;
+    }
+
+    const std::vector<std::string> query_mix = {
+        "SELECT * from USERS",
+        "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'",
+    };
+    std::vector< user_record > records;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        for (const auto& sql : query_mix) {
+            records.clear();
+            sqlite3_exec(db, sql.c_str(), callback, &records, NULL);
+        }
+    }
+    const std::chrono::duration<double, std::micro> exec_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        for (const auto& sql : query_mix) {
+            records.clear();
+            statement_cache::entry* cached = statement_cache_for(db).acquire(sql);
+            if (cached == NULL) {
+                release_statement_cache(db);
+                sqlite3_close(db);
+                return -1;
+            }
+            collect_records(cached->statement, records);
+            sqlite3_reset(cached->statement);
+        }
+    }
+    const std::chrono::duration<double, std::micro> cached_time = std::chrono::steady_clock::now() - start;
+
+    const double queries = static_cast<double>(iterations) * query_mix.size();
+    std::cout << std::endl << "Statement cache benchmark: " << static_cast<long long>(queries) << " queries" << std::endl;
+    std::cout << std::fixed << std::setprecision(2)
+        << "  sqlite3_exec:      " << exec_time.count() / queries << " us/query" << std::endl
+        << "  cached statements: " << cached_time.count() / queries << " us/query" << std::endl;
+    report_statement_cache(db);
+
+    release_statement_cache(db);
+    sqlite3_close(db);
+    return 0;
+}
+
+/**
+ * Decodes a full scan of a `row_count` row USERS table through the sqlite3_exec callback and through the row cursor.
+ */
+int run_decode_benchmark(int row_count, int iterations) {
+    sqlite3* db = NULL;
+    if (sqlite3_open(":memory:", &db) != SQLITE_OK) {
+        sqlite3_close(db);
+        return -1;
+    }
+    sqlite3_exec(db, "CREATE TABLE USERS(ID INT PRIMARY KEY NOT NULL, NAME TEXT NOT NULL, PASSWORD TEXT NOT NULL); BEGIN;", NULL, NULL, NULL);
+    insert_sample_users(db, row_count);
+    sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+
+    const std::string sql = "SELECT * from USERS";
+    std::vector< user_record > records;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        records.clear();
+        sqlite3_exec(db, sql.c_str(), callback, &records, NULL);
+    }
+    const std::chrono::duration<double, std::nano> callback_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        records.clear();
+        statement_cache::entry* cached = statement_cache_for(db).acquire(sql);
+        if (cached == NULL) {
+            release_statement_cache(db);
+            sqlite3_close(db);
+            return -1;
+        }
+        collect_records(cached->statement, records);
+        sqlite3_reset(cached->statement);
+    }
+    const std::chrono::duration<double, std::nano> cursor_time = std::chrono::steady_clock::now() - start;
+
+    // a consumer that reads the typed columns directly, without building user_records
+    start = std::chrono::steady_clock::now();
+    sqlite3_int64 checksum = 0;
+    for (int i = 0; i < iterations; ++i) {
+        statement_cache::entry* cached = statement_cache_for(db).acquire(sql);
+        if (cached == NULL) {
+            release_statement_cache(db);
+            sqlite3_close(db);
+            return -1;
+        }
+        row_cursor cursor(cached->statement);
+        while (cursor.next()) {
+            checksum += cursor.column_int64(0) + static_cast<sqlite3_int64>(cursor.column_text(1).size() + cursor.column_text(2).size());
+        }
+        sqlite3_reset(cached->statement);
+    }
+    const std::chrono::duration<double, std::nano> typed_time = std::chrono::steady_clock::now() - start;
+
+    const double rows = static_cast<double>(row_count) * iterations;
+    std::cout << std::endl << "Row decode benchmark: " << row_count << " rows x " << iterations << " scans" << std::endl;
+    std::cout << std::fixed << std::setprecision(1)
+        << "  sqlite3_exec callback: " << callback_time.count() / rows << " ns/row" << std::endl
+        << "  row cursor:            " << cursor_time.count() / rows << " ns/row" << std::endl
+        << "  row cursor, typed:     " << typed_time.count() / rows << " ns/row (checksum " << checksum << ")" << std::endl;
+
+    release_statement_cache(db);
+    sqlite3_close(db);
+    return 0;
+}
+
+/**
+ * Runs the parameterized statement `sql` with `args` bound and calls `visitor` with a user_row_view for every row. The
+ * views point straight into SQLite's column memory and are only valid during that call, so nothing is copied or
+ * allocated per row. A visitor that returns bool can return false to stop early. Expects the (ID, NAME, PASSWORD)
+ * column order. Returns false if the query could not run or failed part way.
+ */
+template <typename Visitor, typename... Args>
+bool visit_query(sqlite3* db, const std::string& sql, Visitor&& visitor, const Args&... args) {
+    sqlite3_stmt* statement = start_query(db, sql, args...);
+    if (statement == NULL) return false;
+
+    row_cursor cursor(statement);
+    while (cursor.next()) {
+        const user_row_view row{ cursor.column_int64(0), cursor.column_text(1), cursor.column_text(2) };
+        if constexpr (std::is_same_v<std::invoke_result_t<Visitor&, const user_row_view&>, bool>) {
+            if (!visitor(row)) break;
+        }
+        else {
+            visitor(row);
+        }
+    }
+
+    const bool succeeded = !cursor.failed();
+    if (!succeeded) {
+        LOG_ERROR("Data failed to be queried from USERS table. ERROR = ", sqlite3_errmsg(db));
+    }
+    finish_query(statement);
+    return succeeded;
 }
 
 /**
- * Parses the right operand of an expression within a string `str`, where the operator is at index `i` of the string
+ * Streaming counterpart of dump_results: prints each row as it is stepped, straight from SQLite's memory, and flushes
+ * once at the end instead of after every row. The count comes last because it is only known once the rows are done.
  */
-std::string parse_right_operand(std::string str, size_t i) {
-    size_t substr_len = 0;
-    size_t cur = i;
-    while (cur < str.size() && str[cur++] != ' ' && str[cur] != ';') substr_len++;
-    return str.substr(i + 1, substr_len);
+template <typename... Args>
+void dump_query(sqlite3* db, const std::string& sql, const Args&... args) {
+    std::cout << "\nSQL: " << sql << '\n';
+    size_t count = 0;
+    visit_query(db, sql, [&count](const user_row_view& row) {
+        std::cout << "User: " << row.name << " [UID=" << row.id << " PWD=" << row.password << "]\n";
+        ++count;
+    }, args...);
+    std::cout << "==> " << count << " records found." << std::endl;
 }
 
 /**
- * Checks the sqlite query `query` for a suspected sql injection. Returns true if an injection is suspected.
+ * Compares memory per row and the cost of scanning one column for vector<user_record> and the columnar result set.
  */
-bool is_unsafe_query(const std::string& query) {
-	/**
-    * The SQL injection method used in this code is performing any conditional statement that always returns true (e.g., 1=1, 'hi'='hi')
-    * There isn't a reason a SQL query needs have that type of statement, so that is checked for and if found, an injection is suspected
-    * and the query is not run.
-    */
-    std::cout << "Checking query: " << query << std::endl;
-    for (size_t i = 0; i < query.size(); ++i) {
-        if (query[i] == '=') {
-            std::string left = parse_left_operand(query, i);
-            std::string right = parse_right_operand(query, i);
-            if (left.compare(right) == 0) {
-                // Strings match, suspected SQL injection            
-                std::cout << "SQL INJECTION DETECTED WEE WOO WEE WOO PULL OVER" << std::endl;
-                return true;
+int run_columnar_benchmark(int row_count, int iterations) {
+    sqlite3* db = NULL;
+    if (sqlite3_open(":memory:", &db) != SQLITE_OK) {
+        sqlite3_close(db);
+        return -1;
+    }
+    sqlite3_exec(db, "CREATE TABLE USERS(ID INT PRIMARY KEY NOT NULL, NAME TEXT NOT NULL, PASSWORD TEXT NOT NULL); BEGIN;", NULL, NULL, NULL);
+    insert_sample_users(db, row_count);
+    sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+
+    const std::string sql = "SELECT ID, NAME, PASSWORD FROM USERS";
+    const std::vector< user_record > records = query(db, sql);
+    const user_result_set results = query_columnar(db, sql);
+
+    // heap use of the record vector: the tuples, plus any string too long for the small string buffer
+    size_t record_bytes = records.capacity() * sizeof(user_record);
+    const std::string empty;
+    for (const auto& record : records) {
+        for (const std::string* text : { &std::get<0>(record), &std::get<1>(record), &std::get<2>(record) }) {
+            if (text->capacity() > empty.capacity()) record_bytes += text->capacity() + 1;
+        }
+    }
+
+    // scan the NAME column: count names starting with 'F' and total their length
+    size_t record_matches = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        for (const auto& record : records) {
+            const std::string& name = std::get<1>(record);
+            record_matches += !name.empty() && name[0] == 'F' ? name.size() : 0;
+        }
+    }
+    const std::chrono::duration<double, std::nano> record_scan = std::chrono::steady_clock::now() - start;
+
+    size_t columnar_matches = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        for (size_t row = 0; row < results.size(); ++row) {
+            const std::string_view name = results.name(row);
+            columnar_matches += !name.empty() && name[0] == 'F' ? name.size() : 0;
+        }
+    }
+    const std::chrono::duration<double, std::nano> columnar_scan = std::chrono::steady_clock::now() - start;
+
+    const double rows = static_cast<double>(records.size());
+    std::cout << std::endl << "Columnar result benchmark: " << records.size() << " rows" << std::endl;
+    std::cout << std::fixed << std::setprecision(1)
+        << "  vector<user_record>: " << record_bytes / rows << " bytes/row, NAME scan " << record_scan.count() / (rows * iterations) << " ns/row" << std::endl
+        << "  user_result_set:     " << results.memory_bytes() / rows << " bytes/row, NAME scan " << columnar_scan.count() / (rows * iterations) << " ns/row" << std::endl;
+
+    release_statement_cache(db);
+    sqlite3_close(db);
+    return record_matches == columnar_matches && results.size() == records.size() ? 0 : -1;
+}
+
+/**
+ * Times has_tautology over generated WHERE clauses of growing length, each a chain of distinct equalities, and reports
+ * the cost per byte. A linear scan keeps ns/byte flat as the queries grow.
+ */
+int run_detector_benchmark(int max_terms, int iterations) {
+    std::cout << std::endl << "Injection detector benchmark: " << iterations << " scans per length" << std::endl;
+    for (int terms = 1; terms <= max_terms; terms *= 4) {
+        std::string sql = "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'";
+        for (int i = 0; i < terms; ++i) sql += " AND ID" + std::to_string(i) + "=" + std::to_string(i) + " AND /* c */ NOTE='a=b'";
+        sql += ";";
+
+        size_t flagged = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) flagged += has_tautology(sql);
+        const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout << std::fixed << std::setprecision(2)
+            << "  " << std::setw(8) << sql.size() << " bytes: " << elapsed.count() / (static_cast<double>(sql.size()) * iterations)
+            << " ns/byte (" << flagged << " flagged)" << std::endl;
+    }
+    return 0;
+}
+
+/**
+ * Compares one signature_scanner pass against running std::string::find once per signature over a lower cased copy,
+ * for a clean query and an injected one padded to `query_bytes`.
+ */
+int run_signature_benchmark(int query_bytes, int iterations) {
+    std::string clean = "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'";
+    while (clean.size() < static_cast<size_t>(query_bytes)) clean += " AND NAME <> 'Wilma'";
+    const std::string injected = clean + " UNION  SELECT name, sql, 1 FROM sqlite_master; --";
+
+    std::cout << std::endl << "Signature scan benchmark: " << std::size(injection_signatures) << " signatures, "
+        << iterations << " scans" << std::endl;
+    const signature_scanner& scanner = injection_scanner();
+    const std::string* queries[] = { &clean, &injected };
+    for (const std::string* sql : queries) {
+        uint64_t scanner_mask = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) scanner_mask |= scanner.match_mask(*sql);
+        const std::chrono::duration<double, std::nano> scanner_time = std::chrono::steady_clock::now() - start;
+
+        uint64_t find_mask = 0;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            std::string lowered(*sql);
+            std::transform(lowered.begin(), lowered.end(), lowered.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+            for (size_t index = 0; index < std::size(injection_signatures); ++index) {
+                if (lowered.find(injection_signatures[index].pattern) != std::string::npos) find_mask |= uint64_t(1) << index;
             }
         }
+        const std::chrono::duration<double, std::nano> find_time = std::chrono::steady_clock::now() - start;
+
+        const double bytes = static_cast<double>(sql->size()) * iterations;
+        std::cout << std::fixed << std::setprecision(2)
+            << "  " << (sql == &clean ? "clean   " : "injected") << " " << sql->size() << " bytes: scanner "
+            << scanner_time.count() / bytes << " ns/byte (" << std::popcount(scanner_mask) << " signatures), find per signature "
+            << find_time.count() / bytes << " ns/byte (" << std::popcount(find_mask) << " signatures)" << std::endl;
+    }
+    return 0;
+}
+
+/**
+ * Checks a stream of queries that repeats a working set of distinct texts, drawn from a few shapes with changing
+ * literals, once running every check on every query and once through the verdict cache, then repeats the cached run
+ * from `threads` threads at the same time.
+ */
+int run_verdict_cache_benchmark(int query_count, int threads) {
+    struct shape {
+        const char* format;
+        bool numeric; // takes two ints rather than two strings
+    };
+    const shape shapes[] = {
+        { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='%s'", false },
+        { "SELECT ID, NAME, PASSWORD FROM USERS WHERE ID=%d", true },
+        { "select id, name, password from users where name = '%s' and password = '%s'", false },
+        { "SELECT NAME FROM USERS WHERE ID > %d ORDER BY NAME LIMIT %d", true },
+        { "UPDATE USERS SET PASSWORD='%s' WHERE NAME='%s'", false },
+        { "SELECT COUNT(*) FROM USERS WHERE NAME LIKE '%s%%'", false },
+        { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='%s' UNION SELECT 1, name, sql FROM sqlite_master", false },
+        { "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='%s'; DROP TABLE USERS", false },
+    };
+    constexpr int distinct = 2048; // fits the cache, like an application's working set of queries
+    std::vector<std::string> queries;
+    queries.reserve(static_cast<size_t>(query_count));
+    char buffer[256];
+    for (int i = 0; i < query_count; ++i) {
+        const int text = i * 7919 % distinct;
+        const shape& next = shapes[text % std::size(shapes)];
+        const std::string literal = "user" + std::to_string(text);
+        if (next.numeric) std::snprintf(buffer, sizeof(buffer), next.format, text, text % 50 + 1);
+        else std::snprintf(buffer, sizeof(buffer), next.format, literal.c_str(), literal.c_str());
+        queries.emplace_back(buffer);
     }
 
-    return false;
+    verdict_cache cache;
+    size_t checked_unsafe = 0, cached_unsafe = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const std::string& sql : queries) checked_unsafe += check_query(sql).unsafe();
+    const std::chrono::duration<double, std::nano> checked_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (const std::string& sql : queries) cached_unsafe += cache.check(sql).unsafe();
+    const std::chrono::duration<double, std::nano> cached_time = std::chrono::steady_clock::now() - start;
+
+    std::vector<std::thread> workers;
+    start = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&cache, &queries]() {
+            for (const std::string& sql : queries) cache.check(sql);
+        });
+    }
+    for (std::thread& worker : workers) worker.join();
+    const std::chrono::duration<double> threaded_time = std::chrono::steady_clock::now() - start;
+
+    const double count = static_cast<double>(queries.size());
+    std::cout << std::endl << "Verdict cache benchmark: " << queries.size() << " queries over " << distinct << " distinct texts" << std::endl;
+    std::cout << std::fixed << std::setprecision(1)
+        << "  check every query: " << checked_time.count() / count << " ns/query (" << checked_unsafe << " unsafe)" << std::endl
+        << "  verdict cache:     " << cached_time.count() / count << " ns/query (" << cached_unsafe << " unsafe)" << std::endl
+        << "  " << threads << " threads, cached: " << std::setprecision(2) << count * threads / threaded_time.count() / 1e6 << " M lookups/s" << std::endl
+        << "  " << cache.hits() << " hits, " << cache.misses() << " misses, average check on a miss "
+        << cache.average_check_time().count() << " us" << std::endl;
+    return checked_unsafe == cached_unsafe ? 0 : -1;
 }
 
-bool run_query(sqlite3* db, const std::string& sql, std::vector< user_record >& records)
-{
-    if (is_unsafe_query(sql)) return false;
+/**
+ * Times has_always_true_branch on typical and injected WHERE clauses against the one microsecond per query budget.
+ */
+int run_evaluator_benchmark(int iterations) {
+    const std::string queries[] = {
+        "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'",
+        "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' or 2=2;",
+        "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' OR 1+1=2",
+        "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred' OR 'a'||'b'='ab'",
+        "SELECT ID, NAME FROM USERS WHERE (NAME='Fred' OR NAME LIKE 'B%') AND ID BETWEEN 1 AND 3 ORDER BY NAME",
+        "SELECT ID, NAME FROM USERS WHERE ID IN (1, 2, 3) OR PASSWORD=? OR 4 > 3 * 2 - 2 LIMIT 10",
+    };
 
-    // clear any prior results
-    records.clear();
+    std::cout << std::endl << "WHERE evaluator benchmark: " << iterations << " runs per query" << std::endl;
+    double worst = 0.0;
+    for (const std::string& sql : queries) {
+        size_t flagged = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) flagged += has_always_true_branch(sql);
+        const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        const double per_query = elapsed.count() / iterations;
+        worst = std::max(worst, per_query);
+        std::cout << std::fixed << std::setprecision(1) << "  " << std::setw(7) << per_query << " ns  "
+            << (flagged != 0 ? "always true  " : "not constant ") << sql << std::endl;
+    }
+    std::cout << "  slowest " << worst << " ns, " << (worst < 1000.0 ? "within" : "over") << " the 1 us budget" << std::endl;
+    return 0;
+}
+
+/**
+ * Has `threads` threads each log `lines` query trace lines, once through a mutex with a flush per line, as the
+ * std::endl writes did, and once through an async_logger, both into a temporary file. Reports the time callers spend
+ * per line.
+ */
+int run_logging_benchmark(int threads, int lines) {
+    FILE* sink = std::tmpfile();
+    if (sink == NULL) return -1;
+
+    const std::string sql = "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'";
+    auto time_callers = [&](auto&& log_line) {
+        std::vector<std::thread> workers;
+        std::vector<double> latencies(static_cast<size_t>(threads) * lines);
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t]() {
+                for (int i = 0; i < lines; ++i) {
+                    const auto start = std::chrono::steady_clock::now();
+                    log_line(i);
+                    latencies[static_cast<size_t>(t) * lines + i] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+                }
+            });
+        }
+        for (std::thread& worker : workers) worker.join();
+        std::sort(latencies.begin(), latencies.end());
+        double total = 0.0;
+        for (double latency : latencies) total += latency;
+        return std::make_pair(total / latencies.size(), latencies[latencies.size() * 99 / 100]);
+    };
 
-    char* error_message;
-    if (sqlite3_exec(db, sql.c_str(), callback, &records, &error_message) != SQLITE_OK)
+    std::mutex sink_mutex;
+    const auto flushed = time_callers([&](int i) {
+        std::lock_guard<std::mutex> lock(sink_mutex);
+        std::fprintf(sink, "Checking query: %s -- %d\n", sql.c_str(), i);
+        std::fflush(sink);
+    });
+
+    size_t dropped = 0;
+    const auto start = std::chrono::steady_clock::now();
+    std::pair<double, double> queued;
     {
-        std::cout << "Data failed to be queried from USERS table. ERROR = " << error_message << std::endl;
-        sqlite3_free(error_message);
-        return false;
+        async_logger logger(sink, 4096);
+        queued = time_callers([&](int i) { logger.write(log_level::trace, "Checking query: ", sql, " -- ", i); });
+        logger.flush();
+        dropped = logger.dropped_lines();
     }
+    const std::chrono::duration<double, std::milli> drained = std::chrono::steady_clock::now() - start;
+    std::fclose(sink);
 
-    return true;
+    std::cout << std::endl << "Logging benchmark: " << threads << " threads x " << lines << " lines" << std::endl;
+    std::cout << std::fixed << std::setprecision(1)
+        << "  flush per line: " << flushed.first << " ns mean, " << flushed.second << " ns p99 per call" << std::endl
+        << "  async logger:   " << queued.first << " ns mean, " << queued.second << " ns p99 per call, all written in "
+        << drained.count() << " ms, " << dropped << " lines dropped" << std::endl;
+    return 0;
 }
 
-// DO NOT CHANGE
-bool run_query_injection(sqlite3* db, const std::string& sql, std::vector< user_record >& records)
-{
-    std::string injectedSQL(sql);
-    std::string localCopy(sql);
+/**
+ * Loads USERS into a fresh file database three ways and reports rows per second: the initialize_database way, one
+ * multi-statement sqlite3_exec string of INSERTs each committing on its own, and bulk_load_users with and without the
+ * fast pragmas. The exec string is limited to `exec_rows` rows, since every row is its own synced transaction.
+ */
+int run_bulk_load_benchmark(int row_count, int batch_rows, int exec_rows) {
+    const std::string path = "bulk_load_benchmark.db";
+    const char* schema = "CREATE TABLE USERS(ID INT PRIMARY KEY NOT NULL, NAME TEXT NOT NULL, PASSWORD TEXT NOT NULL);";
 
-    // we work on the local copy because of the const
-    std::transform(localCopy.begin(), localCopy.end(), localCopy.begin(), ::tolower);
-    if (localCopy.find_last_of(str_where) >= 0)
-    { // this sql has a where clause
-        if (localCopy.back() == ';')
-        { // smart SQL developer terminated with a semicolon - we can fix that!
-            injectedSQL.pop_back();
+    // opens an empty database and returns the time `load` took and the rows it left in USERS
+    auto timed_load = [&](auto&& load) {
+        std::remove(path.c_str());
+        std::remove((path + "-journal").c_str());
+        sqlite3* db = NULL;
+        if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
+            sqlite3_close(db);
+            return std::make_tuple(0.0, sqlite3_int64(0), std::string());
         }
+        sqlite3_exec(db, schema, NULL, NULL, NULL);
 
-        switch (rand() % 4)
+        const auto start = std::chrono::steady_clock::now();
+        load(db);
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        sqlite3_int64 rows = 0;
+        sqlite3_stmt* count = NULL;
+        if (sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM USERS", -1, &count, NULL) == SQLITE_OK && sqlite3_step(count) == SQLITE_ROW) {
+            rows = sqlite3_column_int64(count, 0);
+        }
+        sqlite3_finalize(count);
+        const std::string settings = "journal_mode=" + read_pragma(db, "journal_mode") + " synchronous=" + read_pragma(db, "synchronous");
+        sqlite3_close(db);
+        return std::make_tuple(elapsed.count(), rows, settings);
+    };
+
+    std::string name;
+    auto next_row = [&name](size_t i) {
+        const sqlite3_int64 id = static_cast<sqlite3_int64>(i) + 1;
+        name = "user" + std::to_string(id);
+        return user_row_view{ id, name, "Flinstone" };
+    };
+
+    const auto exec = timed_load([&](sqlite3* db) {
+        std::string sql;
+        for (int id = 1; id <= exec_rows; ++id) {
+            sql += "INSERT INTO USERS (ID, NAME, PASSWORD)VALUES (" + std::to_string(id) + ", 'user" + std::to_string(id) + "', 'Flinstone');";
+        }
+        sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
+    });
+    const auto durable = timed_load([&](sqlite3* db) {
+        bulk_load_users(db, static_cast<size_t>(row_count), next_row, bulk_load_options{ batch_rows, false });
+    });
+    const auto fast = timed_load([&](sqlite3* db) {
+        bulk_load_users(db, static_cast<size_t>(row_count), next_row, bulk_load_options{ batch_rows, true });
+    });
+    std::remove(path.c_str());
+    std::remove((path + "-journal").c_str());
+
+    std::cout << std::endl << "Bulk load benchmark: " << row_count << " rows, " << batch_rows << " rows per transaction" << std::endl;
+    auto report = [](const char* label, const std::tuple<double, sqlite3_int64, std::string>& result) {
+        const double seconds = std::get<0>(result);
+        std::cout << "  " << label << std::setw(10) << std::get<1>(result) << " rows  " << std::fixed << std::setprecision(0)
+            << std::setw(10) << (seconds > 0.0 ? static_cast<double>(std::get<1>(result)) / seconds : 0.0) << " rows/s  afterwards "
+            << std::get<2>(result) << std::endl;
+    };
+    report("exec string, autocommit:  ", exec);
+    report("bulk loader, durable:     ", durable);
+    report("bulk loader, fast pragmas:", fast);
+    return std::get<1>(durable) == row_count && std::get<1>(fast) == row_count ? 0 : -1;
+}
+
+/**
+ * Measures the latency of a name lookup on USERS tables of 1K rows up to `max_rows`, growing ten times per step, for
+ * three setups: the initialize_database schema with no name index, which scans, the same table with the covering
+ * index, and a WITHOUT ROWID table with the covering index.
+ */
+int run_index_benchmark(int max_rows) {
+    const std::string path = "index_benchmark.db";
+    std::cout << std::endl << "Name lookup benchmark (microseconds per lookup)" << std::endl
+        << "        rows    full scan  covering index  WITHOUT ROWID + index" << std::endl;
+
+    std::string name;
+    auto next_row = [&name](size_t i) {
+        const sqlite3_int64 id = static_cast<sqlite3_int64>(i) + 1;
+        name = "user" + std::to_string(id);
+        return user_row_view{ id, name, "Flinstone" };
+    };
+
+    for (int rows = 1000; rows <= max_rows; rows *= 10) {
+        double latency[3] = {};
+        for (int setup = 0; setup < 3; ++setup) {
+            std::remove(path.c_str());
+            sqlite3* db = NULL;
+            if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
+                sqlite3_close(db);
+                return -1;
+            }
+            create_users_table(db, setup == 2 ? users_layout::without_rowid : users_layout::rowid);
+            bulk_load_users(db, static_cast<size_t>(rows), next_row);
+            if (setup != 0 && !index_users_table(db)) {
+                sqlite3_close(db);
+                return -1;
+            }
+
+            // a scan reads the whole table per lookup, so it gets fewer of them
+            const int lookups = setup == 0 ? std::max(5, 200000 / rows) : 20000;
+            sqlite3_stmt* lookup = NULL;
+            sqlite3_prepare_v2(db, "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME=?", -1, &lookup, NULL);
+            sqlite3_int64 found = 0;
+            const auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < lookups; ++i) {
+                const std::string wanted = "user" + std::to_string(static_cast<sqlite3_int64>(i) * 7919 % rows + 1);
+                sqlite3_bind_text(lookup, 1, wanted.data(), static_cast<int>(wanted.size()), SQLITE_STATIC);
+                while (sqlite3_step(lookup) == SQLITE_ROW) found += sqlite3_column_int64(lookup, 0) != 0;
+                sqlite3_reset(lookup);
+            }
+            const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+            sqlite3_finalize(lookup);
+            sqlite3_close(db);
+            if (found != lookups) {
+                std::cout << "Lookup found " << found << " of " << lookups << " rows." << std::endl;
+                return -1;
+            }
+            latency[setup] = elapsed.count() / lookups;
+        }
+        std::cout << std::fixed << std::setprecision(2) << std::setw(12) << rows << std::setw(13) << latency[0]
+            << std::setw(16) << latency[1] << std::setw(23) << latency[2] << std::endl;
+    }
+    std::remove(path.c_str());
+    return 0;
+}
+
+/**
+ * Runs name lookups from 1 up to `max_threads` threads against a `row_count` row file database, once through a single
+ * shared connection behind a mutex, as main does with its one connection, and once through a connection_pool with a
+ * reader per thread. Reports lookups per second and how long threads waited for a pooled connection.
+ */
+int run_pool_benchmark(int row_count, int max_threads, int lookups_per_thread) {
+    const std::string path = "pool_benchmark.db";
+    const std::string sql = "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME=?";
+    std::remove(path.c_str());
+    std::remove((path + "-wal").c_str());
+    std::remove((path + "-shm").c_str());
+
+    std::cout << std::endl << "Connection pool benchmark: " << row_count << " rows, " << lookups_per_thread << " lookups per thread" << std::endl
+        << "  threads   shared connection   pooled readers   average wait   longest wait" << std::endl;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        connection_pool pool(path, static_cast<size_t>(threads));
+        if (!pool.is_open()) return -1;
         {
-        case 1:
-            injectedSQL.append(" or 2=2;");
-            break;
-        case 2:
-            injectedSQL.append(" or 'hi'='hi';");
-            break;
-        case 3:
-            injectedSQL.append(" or 'hack'='hack';");
-            break;
-        case 0:
-        default:
-            injectedSQL.append(" or 1=1;");
-            break;
+            connection_pool::lease writer = pool.write();
+            if (threads == 1) {
+                std::string name;
+                create_users_table(writer.get(), users_layout::rowid);
+                bulk_load_users(writer.get(), static_cast<size_t>(row_count), [&name](size_t i) {
+                    name = "user" + std::to_string(i + 1);
+                    return user_row_view{ static_cast<sqlite3_int64>(i) + 1, name, "Flinstone" };
+                }, bulk_load_options{ 50000, false });
+                index_users_table(writer.get());
+            }
+        }
+
+        // looks up `count` names with `statement`, returning how many were found
+        auto look_up = [row_count](sqlite3_stmt* statement, int thread, int first, int count) {
+            int found = 0;
+            for (int i = first; i < first + count; ++i) {
+                const std::string wanted = "user" + std::to_string((static_cast<sqlite3_int64>(i) * 7919 + thread) % row_count + 1);
+                sqlite3_bind_text(statement, 1, wanted.data(), static_cast<int>(wanted.size()), SQLITE_STATIC);
+                while (sqlite3_step(statement) == SQLITE_ROW) ++found;
+                sqlite3_reset(statement);
+            }
+            return found;
+        };
+        auto run_threads = [threads](auto&& work) {
+            std::vector<std::thread> workers;
+            std::atomic<int> found{ 0 };
+            const auto start = std::chrono::steady_clock::now();
+            for (int t = 0; t < threads; ++t) workers.emplace_back([&, t]() { found += work(t); });
+            for (std::thread& worker : workers) worker.join();
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            return std::make_pair(elapsed.count(), found.load());
+        };
+
+        sqlite3* shared = NULL;
+        sqlite3_open(path.c_str(), &shared);
+        sqlite3_stmt* shared_lookup = NULL;
+        sqlite3_prepare_v2(shared, sql.c_str(), -1, &shared_lookup, NULL);
+        std::mutex shared_mutex;
+        const auto serial = run_threads([&](int t) {
+            int found = 0;
+            for (int i = 0; i < lookups_per_thread; ++i) {
+                std::lock_guard<std::mutex> lock(shared_mutex);
+                found += look_up(shared_lookup, t, i, 1);
+            }
+            return found;
+        });
+        sqlite3_finalize(shared_lookup);
+        sqlite3_close(shared);
+
+        // each lease covers a batch of lookups, as a worker would hold a connection for a unit of work
+        const auto pooled = run_threads([&](int t) {
+            int found = 0;
+            for (int i = 0; i < lookups_per_thread; i += 100) {
+                connection_pool::lease reader = pool.read();
+                statement_cache::entry* cached = statement_cache_for(reader.get()).acquire(sql);
+                if (cached == NULL) return found;
+                found += look_up(cached->statement, t, i, std::min(100, lookups_per_thread - i));
+            }
+            return found;
+        });
+
+        const int expected = threads * lookups_per_thread;
+        if (serial.second != expected || pooled.second != expected) {
+            std::cout << "Lookups found " << serial.second << " and " << pooled.second << " of " << expected << " rows." << std::endl;
+            return -1;
         }
+        std::cout << std::fixed << std::setprecision(0) << std::setw(9) << threads
+            << std::setw(15) << expected / serial.first << " /s" << std::setw(14) << expected / pooled.first << " /s"
+            << std::setprecision(2) << std::setw(12) << pool.average_wait().count() << " us" << std::setw(12) << pool.longest_wait().count() << " us" << std::endl;
     }
 
-    return run_query(db, injectedSQL, records);
+    std::remove(path.c_str());
+    std::remove((path + "-wal").c_str());
+    std::remove((path + "-shm").c_str());
+    return 0;
 }
 
+/**
+ * Drives a query_executor with `workers` workers from 1 up to `max_clients` client threads, each submitting
+ * `queries_per_client` name lookups against a `row_count` row file database and waiting on every future before
+ * submitting the next. Reports throughput and the median and 99th percentile latency seen by the clients, then
+ * cancels a query that would otherwise run for a very long time and reports how quickly it stopped.
+ */
+int run_executor_benchmark(int row_count, int workers, int max_clients, int queries_per_client) {
+    const std::string path = "executor_benchmark.db";
+    std::remove(path.c_str());
+    std::remove((path + "-wal").c_str());
+    std::remove((path + "-shm").c_str());
 
-// DO NOT CHANGE
-void dump_results(const std::string& sql, const std::vector< user_record >& records)
-{
-    std::cout << std::endl << "SQL: " << sql << " ==> " << records.size() << " records found." << std::endl;
-
-    for (auto record : records)
+    int return_code = 0;
     {
-        std::cout << "User: " << std::get<1>(record) << " [UID=" << std::get<0>(record) << " PWD=" << std::get<2>(record) << "]" << std::endl;
+        connection_pool pool(path, static_cast<size_t>(workers));
+        if (!pool.is_open()) return -1;
+        {
+            connection_pool::lease writer = pool.write();
+            std::string name;
+            create_users_table(writer.get(), users_layout::rowid);
+            bulk_load_users(writer.get(), static_cast<size_t>(row_count), [&name](size_t i) {
+                name = "user" + std::to_string(i + 1);
+                return user_row_view{ static_cast<sqlite3_int64>(i) + 1, name, "Flinstone" };
+            }, bulk_load_options{ 50000, false });
+            index_users_table(writer.get());
+        }
+
+        // a queue of two jobs per worker, so that the larger client counts run into back-pressure
+        query_executor executor(pool, static_cast<size_t>(workers), static_cast<size_t>(workers) * 2);
+        std::cout << std::endl << "Query executor benchmark: " << row_count << " rows, " << workers << " workers, "
+            << queries_per_client << " lookups per client" << std::endl
+            << "  clients   lookups/s   p50 latency   p99 latency   blocked submits" << std::endl;
+        for (int clients = 1; clients <= max_clients && return_code == 0; clients *= 2) {
+            std::vector<std::vector<double>> latencies(clients);
+            std::atomic<int> found{ 0 };
+            const size_t blocked_before = executor.blocked_submissions();
+            const auto start = std::chrono::steady_clock::now();
+            std::vector<std::thread> threads;
+            for (int c = 0; c < clients; ++c) {
+                threads.emplace_back([&, c]() {
+                    latencies[c].reserve(queries_per_client);
+                    for (int i = 0; i < queries_per_client; ++i) {
+                        const std::string wanted = "user" + std::to_string((static_cast<sqlite3_int64>(i) * 7919 + c) % row_count + 1);
+                        const auto submitted = std::chrono::steady_clock::now();
+                        const query_result result = executor.submit("SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME=?", wanted).get();
+                        latencies[c].push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - submitted).count());
+                        found += static_cast<int>(result.records.size());
+                    }
+                });
+            }
+            for (std::thread& thread : threads) thread.join();
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+            std::vector<double> all;
+            for (const std::vector<double>& client : latencies) all.insert(all.end(), client.begin(), client.end());
+            std::sort(all.begin(), all.end());
+            const int expected = clients * queries_per_client;
+            if (found != expected) {
+                std::cout << "Lookups found " << found << " of " << expected << " rows." << std::endl;
+                return_code = -1;
+                break;
+            }
+            std::cout << std::fixed << std::setprecision(0) << std::setw(9) << clients << std::setw(12) << expected / elapsed.count()
+                << std::setprecision(1) << std::setw(11) << all[all.size() / 2] << " us" << std::setw(11) << all[all.size() * 99 / 100] << " us"
+                << std::setw(18) << executor.blocked_submissions() - blocked_before << std::endl;
+        }
+
+        // a join of USERS with itself that matches nothing, so it has to visit every pair of rows
+        if (return_code == 0) {
+            std::stop_source stop;
+            std::future<query_result> slow = executor.submit(stop.get_token(),
+                "SELECT a.ID, a.NAME, b.PASSWORD FROM USERS a, USERS b WHERE a.ID + b.ID = 0");
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            const auto cancelled_at = std::chrono::steady_clock::now();
+            stop.request_stop();
+            const query_result result = slow.get();
+            const std::chrono::duration<double, std::milli> stopped_after = std::chrono::steady_clock::now() - cancelled_at;
+            std::cout << "Cancelled a full self-join after " << std::fixed << std::setprecision(1) << result.ran.count() / 1000.0
+                << " ms of running; it stopped " << std::setprecision(3) << stopped_after.count() << " ms after the request ("
+                << (result.status == query_result::outcome::cancelled ? "cancelled" : "not cancelled") << ")" << std::endl;
+            if (result.status != query_result::outcome::cancelled) return_code = -1;
+        }
     }
+
+    std::remove(path.c_str());
+    std::remove((path + "-wal").c_str());
+    std::remove((path + "-shm").c_str());
+    return return_code;
 }
 
-// DO NOT CHANGE
-void run_queries(sqlite3* db)
-{
-    char* error_message = NULL;
+/**
+ * Compares the cold start, building a `row_count` row USERS table with its name index from SQL text as
+ * initialize_database does, with two warm starts from an image of the built database: loading the image into a
+ * ":memory:" connection with load_database_image, and opening the image file in place read-only and memory-mapped.
+ * Each start ends with one name lookup, so the schema has been read; the warm starts are averaged over `iterations`.
+ */
+int run_snapshot_benchmark(int row_count, int iterations) {
+    const std::string path = "snapshot_benchmark.img";
+    const std::string lookup = "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='user" + std::to_string(row_count / 2 + 1) + "'";
+    using milliseconds = std::chrono::duration<double, std::milli>;
+
+    // runs the lookup on `db` and closes it, returning how many rows it found
+    auto look_up_and_close = [&lookup](sqlite3* db) {
+        std::vector< user_record > records;
+        sqlite3_exec(db, lookup.c_str(), callback, &records, NULL);
+        sqlite3_close(db);
+        return records.size();
+    };
 
+    auto start = std::chrono::steady_clock::now();
+    sqlite3* db = NULL;
+    sqlite3_open(":memory:", &db);
+    std::string sql = "CREATE TABLE USERS(ID INT PRIMARY KEY NOT NULL, NAME TEXT NOT NULL, PASSWORD TEXT NOT NULL); BEGIN;";
+    for (int id = 1; id <= row_count; ++id) {
+        sql += "INSERT INTO USERS (ID, NAME, PASSWORD)VALUES (" + std::to_string(id) + ", 'user" + std::to_string(id) + "', 'Flinstone');";
+    }
+    sql += "COMMIT;";
+    const bool built = sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL) == SQLITE_OK && index_users_table(db);
     std::vector< user_record > records;
+    sqlite3_exec(db, lookup.c_str(), callback, &records, NULL);
+    const milliseconds rebuild = std::chrono::steady_clock::now() - start;
 
-    // query all
-    std::string sql = "SELECT * from USERS";
-    if (!run_query(db, sql, records)) return;
-    dump_results(sql, records);
+    start = std::chrono::steady_clock::now();
+    const bool saved = built && save_database_image(db, path);
+    const milliseconds save = std::chrono::steady_clock::now() - start;
+    sqlite3_close(db);
+    if (!saved || records.size() != 1) {
+        std::cout << "Failed to build and save the snapshot benchmark database." << std::endl;
+        std::remove(path.c_str());
+        return -1;
+    }
 
-    //  query 1
-    sql = "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME='Fred'";
-    if (!run_query(db, sql, records)) return;
-    dump_results(sql, records);
+    size_t found = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        sqlite3* warm = NULL;
+        sqlite3_open(":memory:", &warm);
+        if (load_database_image(warm, path)) found += look_up_and_close(warm);
+        else sqlite3_close(warm);
+    }
+    const milliseconds deserialize = (std::chrono::steady_clock::now() - start) / std::max(iterations, 1);
 
-    //  run query 1 with injection 5 times
-    for (auto i = 0; i < 5; ++i)
-    {
-        if (!run_query_injection(db, sql, records)) continue;
-        dump_results(sql, records);
+    // immutable=1 tells SQLite nothing else changes the file, so it takes no locks and keeps no journal
+    const std::string uri = "file:" + path + "?immutable=1";
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        sqlite3* mapped = NULL;
+        if (sqlite3_open_v2(uri.c_str(), &mapped, SQLITE_OPEN_READONLY | SQLITE_OPEN_URI, NULL) == SQLITE_OK &&
+            sqlite3_exec(mapped, "PRAGMA mmap_size=1073741824", NULL, NULL, NULL) == SQLITE_OK) {
+            found += look_up_and_close(mapped);
+        }
+        else {
+            sqlite3_close(mapped);
+        }
     }
+    const milliseconds memory_mapped = (std::chrono::steady_clock::now() - start) / std::max(iterations, 1);
+
+    std::error_code error;
+    const std::uintmax_t image_bytes = std::filesystem::file_size(path, error);
+    std::remove(path.c_str());
 
+    std::cout << std::endl << "Snapshot benchmark: " << row_count << " rows, " << image_bytes / 1024 << " KiB image, saved in "
+        << std::fixed << std::setprecision(2) << save.count() << " ms" << std::endl
+        << "  rebuild from SQL text:       " << std::setw(10) << rebuild.count() << " ms" << std::endl
+        << "  deserialize image:           " << std::setw(10) << deserialize.count() << " ms" << std::endl
+        << "  open image read-only, mmap:  " << std::setw(10) << memory_mapped.count() << " ms" << std::endl;
+    return found == static_cast<size_t>(iterations) * 2 ? 0 : -1;
 }
 
 // You can change main by adding stuff to it, but all of the existing code must remain, and be in the
 // in the order called, and with none of this existing code placed into conditional statements
-int main()
+int main(int argc, char* argv[])
 {
     // initialize random seed:
     srand(time(nullptr));
@@ -243,15 +3831,134 @@ int main()
     }
     else
     {
+        // index the name lookups before running them, and make sure the planner picks the index
+        if (!index_users_table(db) || !check_users_query_plans(db))
+        {
+            std::cout << "Name lookups on USERS are not using " << users_name_index << "." << std::endl;
+            return_code = -1;
+        }
         run_queries(db);
     }
 
+    // the same lookup through the parameterized API: the name is bound as a value, so an injected
+    // tautology is just a name that matches nobody
+    if (return_code == 0)
+    {
+        const std::string parameterized_sql = "SELECT ID, NAME, PASSWORD FROM USERS WHERE NAME=?";
+        dump_results(parameterized_sql, query(db, parameterized_sql, "Fred"));
+        dump_results(parameterized_sql, query(db, parameterized_sql, "Fred' or 1=1;"));
+        dump_query(db, "SELECT ID, NAME, PASSWORD FROM USERS WHERE PASSWORD=?", "Rubble");
+    }
+
+    // the signatures that match number literals must still fire once a query's shape is cached
+    if (return_code == 0 && !check_literal_signatures())
+    {
+        return_code = -1;
+    }
+
+    // let the query log catch up so the reports follow it
+    query_log().flush();
+
+    // report on the cached statements, then finalize them so the connection can close
+    if (db != NULL)
+    {
+        report_statement_cache(db);
+        release_statement_cache(db);
+    }
+
+    // report how often the injection checks reused the verdict for a query shape
+    report_verdict_cache();
+
     // close the connection if opened
     if (db != NULL)
     {
         sqlite3_close(db);
     }
 
+    // optional benchmark modes run after the example, selected by the first command line argument
+    if (argc > 1 && return_code == 0)
+    {
+        const std::string mode = argv[1];
+        if (mode == "--bench-vfs")
+        {
+            // optional arguments: row count, iterations
+            return_code = run_vfs_benchmark(argc > 2 ? std::stoi(argv[2]) : 100000, argc > 3 ? std::stoi(argv[3]) : 20);
+        }
+        else if (mode == "--bench-decode")
+        {
+            // optional arguments: row count, scans
+            return_code = run_decode_benchmark(argc > 2 ? std::stoi(argv[2]) : 100000, argc > 3 ? std::stoi(argv[3]) : 20);
+        }
+        else if (mode == "--bench-columnar")
+        {
+            // optional arguments: row count, scans
+            return_code = run_columnar_benchmark(argc > 2 ? std::stoi(argv[2]) : 1000000, argc > 3 ? std::stoi(argv[3]) : 20);
+        }
+        else if (mode == "--bench-statement-cache")
+        {
+            // optional argument: iterations of the query mix
+            return_code = run_statement_cache_benchmark(argc > 2 ? std::stoi(argv[2]) : 100000);
+        }
+        else if (mode == "--bench-detector")
+        {
+            // optional arguments: largest number of WHERE terms, scans per length
+            return_code = run_detector_benchmark(argc > 2 ? std::stoi(argv[2]) : 4096, argc > 3 ? std::stoi(argv[3]) : 200);
+        }
+        else if (mode == "--bench-signatures")
+        {
+            // optional arguments: query length in bytes, scans
+            return_code = run_signature_benchmark(argc > 2 ? std::stoi(argv[2]) : 4096, argc > 3 ? std::stoi(argv[3]) : 20000);
+        }
+        else if (mode == "--bench-evaluator")
+        {
+            // optional argument: runs per query
+            return_code = run_evaluator_benchmark(argc > 2 ? std::stoi(argv[2]) : 200000);
+        }
+        else if (mode == "--bench-logging")
+        {
+            // optional arguments: threads, lines per thread
+            return_code = run_logging_benchmark(argc > 2 ? std::stoi(argv[2]) : 4, argc > 3 ? std::stoi(argv[3]) : 200000);
+        }
+        else if (mode == "--bench-bulk-load")
+        {
+            // optional arguments: row count, rows per transaction, rows for the exec string
+            return_code = run_bulk_load_benchmark(argc > 2 ? std::stoi(argv[2]) : 1000000, argc > 3 ? std::stoi(argv[3]) : 50000,
+                argc > 4 ? std::stoi(argv[4]) : 2000);
+        }
+        else if (mode == "--bench-index")
+        {
+            // optional argument: largest table, e.g. 10000000
+            return_code = run_index_benchmark(argc > 2 ? std::stoi(argv[2]) : 1000000);
+        }
+        else if (mode == "--bench-pool")
+        {
+            // optional arguments: row count, most threads, lookups per thread
+            return_code = run_pool_benchmark(argc > 2 ? std::stoi(argv[2]) : 100000, argc > 3 ? std::stoi(argv[3]) : 8,
+                argc > 4 ? std::stoi(argv[4]) : 20000);
+        }
+        else if (mode == "--bench-executor")
+        {
+            // optional arguments: row count, workers, most client threads, lookups per client
+            return_code = run_executor_benchmark(argc > 2 ? std::stoi(argv[2]) : 100000, argc > 3 ? std::stoi(argv[3]) : 4,
+                argc > 4 ? std::stoi(argv[4]) : 32, argc > 5 ? std::stoi(argv[5]) : 2000);
+        }
+        else if (mode == "--bench-snapshot")
+        {
+            // optional arguments: row count, iterations
+            return_code = run_snapshot_benchmark(argc > 2 ? std::stoi(argv[2]) : 1000000, argc > 3 ? std::stoi(argv[3]) : 20);
+        }
+        else if (mode == "--bench-verdict-cache")
+        {
+            // optional arguments: query count, threads
+            return_code = run_verdict_cache_benchmark(argc > 2 ? std::stoi(argv[2]) : 1000000, argc > 3 ? std::stoi(argv[3]) : 4);
+        }
+        else
+        {
+            std::cout << "Unknown option: " << mode << std::endl;
+            return_code = -1;
+        }
+    }
+
     return return_code;
 }
 
@@ -6,6 +6,51 @@
 #include <sstream>
 #include <ctime>
 #include <filesystem>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#endif
 
 /// <summary>
 /// encrypt or decrypt a source string using the provided key
@@ -40,6 +85,128 @@ std::string encrypt_decrypt(const std::string& source, const std::string& key)
     return output;
 }
 
+/// <summary>
+/// encrypt or decrypt a block of data in place, continuing the key stream at the given phase
+/// </summary>
+/// <param name="data">buffer to transform in place</param>
+/// <param name="length">number of bytes in the buffer</param>
+/// <param name="key">key to use in encryption / decryption</param>
+/// <param name="phase">offset of the first byte of the block within the whole stream</param>
+void encrypt_decrypt_block(char* data, size_t length, const std::string& key, size_t phase)
+{
+    const auto key_length = key.length();
+    assert(key_length > 0);
+
+    // walk the key with a wrapping index so blocks can be split anywhere in the stream
+    size_t key_index = phase % key_length;
+    for (size_t i = 0; i < length; ++i)
+    {
+        data[i] ^= key[key_index];
+        if (++key_index == key_length)
+        {
+            key_index = 0;
+        }
+    }
+}
+
+/// <summary>
+/// many small records packed into one buffer: record i is data[offsets[i]] up to data[offsets[i + 1]]
+/// </summary>
+struct record_batch
+{
+    std::vector<char> data;
+    std::vector<uint32_t> offsets{ 0 };
+
+    size_t size() const { return offsets.size() - 1; }
+
+    void add(std::string_view record)
+    {
+        assert(data.size() + record.size() <= UINT32_MAX);
+        data.insert(data.end(), record.begin(), record.end());
+        offsets.push_back(static_cast<uint32_t>(data.size()));
+    }
+
+    std::string_view operator[](size_t index) const
+    {
+        return std::string_view(data.data() + offsets[index], offsets[index + 1] - offsets[index]);
+    }
+};
+
+/// <summary>
+/// xor length bytes against a key stream whose length is a whole number of key periods, restarting
+/// the stream as needed; the inner loop has no modulo so the compiler vectorizes it
+/// </summary>
+void xor_key_stream(const char* input, char* output, size_t length, const char* stream, size_t stream_length)
+{
+    while (length > 0)
+    {
+        const size_t step = std::min(length, stream_length);
+        for (size_t i = 0; i < step; ++i)
+        {
+            output[i] = input[i] ^ stream[i];
+        }
+        input += step;
+        output += step;
+        length -= step;
+    }
+}
+
+/// <summary>
+/// encrypt or decrypt every record of a packed batch in one sweep; the key stream restarts at the
+/// beginning of each record
+/// </summary>
+/// <param name="data">packed record bytes</param>
+/// <param name="offsets">record_count + 1 offsets into data</param>
+/// <param name="record_count">number of records</param>
+/// <param name="keys">one key shared by every record, or one key per record</param>
+/// <param name="output">arena receiving the transformed records at the same offsets; may be data itself</param>
+void encrypt_batch(const char* data, const uint32_t* offsets, size_t record_count, const std::vector<std::string>& keys, char* output)
+{
+    assert(keys.size() == 1 || keys.size() == record_count);
+
+    if (keys.size() == 1)
+    {
+        // repeat the shared key into one stream of at least 256 bytes, which covers typical records in a single pass
+        const std::string& key = keys.front();
+        assert(!key.empty());
+        const size_t periods = (256 + key.length() - 1) / key.length();
+        std::string stream;
+        stream.reserve(periods * key.length());
+        for (size_t i = 0; i < periods; ++i)
+        {
+            stream += key;
+        }
+
+        for (size_t record = 0; record < record_count; ++record)
+        {
+            const uint32_t begin = offsets[record];
+            xor_key_stream(data + begin, output + begin, offsets[record + 1] - begin, stream.data(), stream.size());
+        }
+        return;
+    }
+
+    // per-record keys: each key is its own stream, one period long
+    for (size_t record = 0; record < record_count; ++record)
+    {
+        const std::string& key = keys[record];
+        assert(!key.empty());
+        const uint32_t begin = offsets[record];
+        xor_key_stream(data + begin, output + begin, offsets[record + 1] - begin, key.data(), key.size());
+    }
+}
+
+/// <summary>
+/// encrypt or decrypt every record of a batch into a new batch with the same layout
+/// </summary>
+record_batch encrypt_batch(const record_batch& records, const std::vector<std::string>& keys)
+{
+    record_batch output;
+    output.offsets = records.offsets;
+    output.data.resize(records.data.size());
+    encrypt_batch(records.data.data(), records.offsets.data(), records.size(), keys, output.data.data());
+    return output;
+}
+
 std::string read_file(const std::string& filename)
 {
     // String to hold file contents
@@ -91,7 +258,11 @@ void save_data_file(const std::string& filename, const std::string& student_name
     std::time_t rawtime;
 
     std::time(&rawtime); // gets the POSIX time
+#ifdef _WIN32
     localtime_s(&timeinfo, &rawtime); // Converts POSIX time to local timestamp
+#else
+    localtime_r(&rawtime, &timeinfo); // POSIX equivalent of localtime_s
+#endif
 
     char timestamp[80]; // Date string buffer
     std::strftime(timestamp, 80, "%Y-%m-%d", &timeinfo); // Format the date string
@@ -105,8 +276,2445 @@ void save_data_file(const std::string& filename, const std::string& student_name
     output_file.close();
 }
 
-int main()
+/// <summary>
+/// state shared by every task promise: who to resume when the task finishes and any escaped exception
+/// </summary>
+struct task_promise_base
+{
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr exception;
+
+    // when a task finishes, transfer straight to whoever awaited it instead of returning to the scheduler
+    struct final_awaiter
+    {
+        bool await_ready() const noexcept { return false; }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) const noexcept
+        {
+            return handle.promise().continuation;
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    final_awaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() noexcept { exception = std::current_exception(); }
+
+    void rethrow_if_failed() const
+    {
+        if (exception)
+        {
+            std::rethrow_exception(exception);
+        }
+    }
+};
+
+template <typename T>
+struct task_promise : task_promise_base
+{
+    std::optional<T> value;
+
+    void return_value(T result) { value = std::move(result); }
+
+    T take()
+    {
+        rethrow_if_failed();
+        return std::move(*value);
+    }
+};
+
+template <>
+struct task_promise<void> : task_promise_base
+{
+    void return_void() noexcept {}
+
+    void take() const { rethrow_if_failed(); }
+};
+
+/// <summary>
+/// lazily started coroutine; the body runs when the task is awaited and resumes the awaiter when done
+/// </summary>
+/// <typeparam name="T">type produced by co_return</typeparam>
+template <typename T = void>
+class task
+{
+public:
+    struct promise_type : task_promise<T>
+    {
+        task get_return_object() noexcept
+        {
+            return task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+    };
+
+    task(task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+    task& operator=(task&&) = delete;
+
+    ~task()
+    {
+        if (handle)
+        {
+            handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+
+    T await_resume() { return handle.promise().take(); }
+
+private:
+    explicit task(std::coroutine_handle<promise_type> coroutine) : handle(coroutine) {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+/// <summary>
+/// fixed set of worker threads that resume suspended coroutines
+/// </summary>
+class thread_pool
+{
+public:
+    explicit thread_pool(size_t thread_count)
+    {
+        for (size_t i = 0; i < thread_count; ++i)
+        {
+            workers.emplace_back([this] { run(); });
+        }
+    }
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    /// <summary>
+    /// queue a suspended coroutine to be resumed on one of the workers
+    /// </summary>
+    void post(std::coroutine_handle<> handle)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(handle);
+        }
+        ready.notify_one();
+    }
+
+    /// <summary>
+    /// co_await pool.schedule() moves the awaiting coroutine onto a worker thread
+    /// </summary>
+    auto schedule()
+    {
+        struct schedule_awaiter
+        {
+            thread_pool& pool;
+
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> handle) const { pool.post(handle); }
+            void await_resume() const noexcept {}
+        };
+        return schedule_awaiter{ *this };
+    }
+
+    size_t size() const { return workers.size(); }
+
+private:
+    void run()
+    {
+        for (;;)
+        {
+            std::coroutine_handle<> handle;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty())
+                {
+                    return;
+                }
+                handle = queue.front();
+                queue.pop_front();
+            }
+            handle.resume();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::coroutine_handle<>> queue;
+    std::vector<std::thread> workers;
+    bool stopping = false;
+};
+
+class io_loop;
+
+enum class io_operation { open, read, write, close };
+
+/// <summary>
+/// a single pending file operation; it lives in the awaiting coroutine's frame until it completes
+/// </summary>
+struct io_request
+{
+    io_loop& loop;
+    io_operation operation;
+    std::FILE*& file;
+    const char* path;
+    const char* mode;
+    char* buffer;
+    size_t size;
+    size_t result = 0;
+    bool failed = false;
+    std::coroutine_handle<> continuation = nullptr;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle);
+
+    size_t await_resume() const
+    {
+        if (failed)
+        {
+            throw std::runtime_error("asynchronous file operation failed");
+        }
+        return result;
+    }
+
+    /// <summary>
+    /// perform the blocking call; only ever runs on an I/O thread
+    /// </summary>
+    void execute() noexcept
+    {
+        switch (operation)
+        {
+        case io_operation::open:
+            file = std::fopen(path, mode);
+            failed = (file == nullptr);
+            break;
+        case io_operation::read:
+            result = std::fread(buffer, 1, size, file);
+            failed = (result < size) && std::ferror(file);
+            break;
+        case io_operation::write:
+            result = std::fwrite(buffer, 1, size, file);
+            failed = (result != size);
+            break;
+        case io_operation::close:
+            failed = (std::fclose(file) != 0);
+            file = nullptr;
+            break;
+        }
+    }
+};
+
+/// <summary>
+/// event loop that runs blocking file calls on a few dedicated threads and hands
+/// the awaiting coroutine back to the worker pool once the call completes
+/// </summary>
+class io_loop
+{
+public:
+    io_loop(thread_pool& pool, size_t thread_count) : pool(pool)
+    {
+        for (size_t i = 0; i < thread_count; ++i)
+        {
+            threads.emplace_back([this] { run(); });
+        }
+    }
+
+    ~io_loop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    io_loop(const io_loop&) = delete;
+    io_loop& operator=(const io_loop&) = delete;
+
+    void submit(io_request* request)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.push_back(request);
+        }
+        ready.notify_one();
+    }
+
+private:
+    void run()
+    {
+        for (;;)
+        {
+            io_request* request;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [this] { return stopping || !pending.empty(); });
+                if (pending.empty())
+                {
+                    return;
+                }
+                request = pending.front();
+                pending.pop_front();
+            }
+            request->execute();
+            // the request may be destroyed as soon as its coroutine resumes, so do not touch it after posting
+            pool.post(request->continuation);
+        }
+    }
+
+    thread_pool& pool;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<io_request*> pending;
+    std::vector<std::thread> threads;
+    bool stopping = false;
+};
+
+void io_request::await_suspend(std::coroutine_handle<> handle)
+{
+    continuation = handle;
+    loop.submit(this);
+}
+
+/// <summary>
+/// file handle whose open, read, write and close are awaited instead of blocking the caller
+/// </summary>
+class async_file
+{
+public:
+    explicit async_file(io_loop& loop) : loop(loop) {}
+
+    ~async_file()
+    {
+        // normally closed with co_await close(); this only covers early exits such as exceptions
+        if (file != nullptr)
+        {
+            std::fclose(file);
+        }
+    }
+
+    async_file(const async_file&) = delete;
+    async_file& operator=(const async_file&) = delete;
+
+    io_request open(const std::string& path, const char* mode)
+    {
+        return io_request{ loop, io_operation::open, file, path.c_str(), mode, nullptr, 0 };
+    }
+
+    io_request read(char* buffer, size_t size)
+    {
+        return io_request{ loop, io_operation::read, file, nullptr, nullptr, buffer, size };
+    }
+
+    io_request write(const char* buffer, size_t size)
+    {
+        return io_request{ loop, io_operation::write, file, nullptr, nullptr, const_cast<char*>(buffer), size };
+    }
+
+    io_request close()
+    {
+        return io_request{ loop, io_operation::close, file, nullptr, nullptr, nullptr, 0 };
+    }
+
+private:
+    io_loop& loop;
+    std::FILE* file = nullptr;
+};
+
+/// <summary>
+/// worker pool plus I/O loop used by the asynchronous file API
+/// </summary>
+struct async_runtime
+{
+    async_runtime(size_t worker_count, size_t io_thread_count) : pool(worker_count), io(pool, io_thread_count) {}
+
+    thread_pool pool;
+    io_loop io;
+};
+
+/// <summary>
+/// asynchronously encrypt or decrypt a file chunk by chunk
+/// </summary>
+/// <param name="runtime">worker pool and I/O loop to run on</param>
+/// <param name="path_in">file to read</param>
+/// <param name="path_out">file to create with the transformed contents</param>
+/// <param name="key">key to use in encryption / decryption</param>
+/// <param name="chunk_size">bytes read, transformed and written per step</param>
+task<void> encrypt_file(async_runtime& runtime, std::string path_in, std::string path_out, std::string key, size_t chunk_size = 64 * 1024)
+{
+    // parameters are taken by value because they must live in the coroutine frame
+    async_file input(runtime.io);
+    async_file output(runtime.io);
+    co_await input.open(path_in, "rb");
+    co_await output.open(path_out, "wb");
+
+    std::vector<char> buffer(chunk_size);
+    size_t phase = 0;
+    for (;;)
+    {
+        const size_t bytes_read = co_await input.read(buffer.data(), buffer.size());
+        if (bytes_read == 0)
+        {
+            break;
+        }
+
+        // I/O completions resume on the worker pool, so the transform already runs there
+        encrypt_decrypt_block(buffer.data(), bytes_read, key, phase);
+        phase += bytes_read;
+
+        co_await output.write(buffer.data(), bytes_read);
+    }
+
+    co_await input.close();
+    co_await output.close();
+}
+
+/// <summary>
+/// counts outstanding fire-and-forget jobs so a plain thread can wait for all of them
+/// </summary>
+class job_group
+{
+public:
+    void add(size_t count)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending += count;
+    }
+
+    void finish(bool succeeded)
+    {
+        // notify while holding the lock so the group cannot be destroyed under us
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!succeeded)
+        {
+            ++failures;
+        }
+        if (--pending == 0)
+        {
+            done.notify_all();
+        }
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return pending == 0; });
+    }
+
+    size_t failed()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return failures;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t pending = 0;
+    size_t failures = 0;
+};
+
+/// <summary>
+/// coroutine that starts immediately and frees itself when it finishes
+/// </summary>
+struct detached_task
+{
+    struct promise_type
+    {
+        detached_task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+/// <summary>
+/// run a task on the worker pool and report its completion to the group (call group.add first)
+/// </summary>
+detached_task spawn(thread_pool& pool, task<void> work, job_group& group)
+{
+    co_await pool.schedule();
+
+    bool succeeded = true;
+    try
+    {
+        co_await work;
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "Asynchronous job failed: " << e.what() << std::endl;
+        succeeded = false;
+    }
+
+    group.finish(succeeded);
+}
+
+/// <summary>
+/// raise the open file limit as far as the platform allows; returns the resulting limit
+/// </summary>
+size_t raise_open_file_limit()
+{
+#ifdef _WIN32
+    // the C runtime caps open FILE streams separately from the OS handle limit
+    return static_cast<size_t>(_setmaxstdio(8192) == -1 ? _getmaxstdio() : 8192);
+#else
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+    {
+        return 1024;
+    }
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    getrlimit(RLIMIT_NOFILE, &limit);
+    return static_cast<size_t>(limit.rlim_cur);
+#endif
+}
+
+/// <summary>
+/// one benchmark lane: encrypts its share of the jobs one after another
+/// </summary>
+task<void> run_benchmark_lane(async_runtime& runtime, const std::vector<std::string>& inputs, std::string output, std::string key, size_t first_job, size_t stride, size_t job_count)
+{
+    for (size_t job = first_job; job < job_count; job += stride)
+    {
+        co_await encrypt_file(runtime, inputs[job % inputs.size()], output, key, 16 * 1024);
+    }
+}
+
+/// <summary>
+/// measure how encryption throughput scales with the number of file jobs in flight at once
+/// </summary>
+int run_async_benchmark()
+{
+    namespace fs = std::filesystem;
+
+    const size_t file_size = 16 * 1024;
+    const size_t input_count = 64;
+    const size_t job_count = 8192;
+    const std::string key = "password";
+
+    const fs::path work_dir = fs::temp_directory_path() / "m5_async_benchmark";
+    fs::create_directories(work_dir);
+
+    // a small pool of distinct inputs shared by every job
+    std::vector<std::string> inputs;
+    for (size_t i = 0; i < input_count; ++i)
+    {
+        const std::string path = (work_dir / ("input" + std::to_string(i) + ".bin")).string();
+        std::ofstream input(path, std::ios::binary);
+        for (size_t j = 0; j < file_size; ++j)
+        {
+            input.put(static_cast<char>('a' + (i + j) % 26));
+        }
+        inputs.push_back(path);
+    }
+
+    // every job in flight holds an input and an output file open
+    const size_t file_limit = raise_open_file_limit();
+    const size_t worker_count = std::max<size_t>(2, std::thread::hardware_concurrency());
+    const size_t io_thread_count = 2;
+    async_runtime runtime(worker_count, io_thread_count);
+
+    std::cout << "Async encryption benchmark: " << job_count << " jobs of " << file_size / 1024 << " KiB, "
+        << worker_count << " worker threads, " << io_thread_count << " I/O threads" << std::endl;
+    std::cout << std::setw(16) << "jobs in flight" << std::setw(14) << "jobs/s" << std::setw(12) << "MB/s" << std::endl;
+
+    for (size_t concurrency : { 1, 4, 16, 64, 256, 1024, 4096 })
+    {
+        if (concurrency * 2 + 64 > file_limit)
+        {
+            std::cout << std::setw(16) << concurrency << "  skipped, open file limit is " << file_limit << std::endl;
+            continue;
+        }
+
+        job_group group;
+        group.add(concurrency);
+
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t lane = 0; lane < concurrency; ++lane)
+        {
+            const std::string output = (work_dir / ("output" + std::to_string(lane) + ".bin")).string();
+            spawn(runtime.pool, run_benchmark_lane(runtime, inputs, output, key, lane, concurrency, job_count), group);
+        }
+        group.wait();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        if (group.failed() != 0)
+        {
+            std::cout << group.failed() << " benchmark lanes failed" << std::endl;
+            fs::remove_all(work_dir);
+            return 1;
+        }
+
+        const double jobs_per_second = job_count / elapsed.count();
+        const double megabytes_per_second = jobs_per_second * file_size / (1024.0 * 1024.0);
+        std::cout << std::setw(16) << concurrency << std::setw(14) << std::fixed << std::setprecision(0) << jobs_per_second
+            << std::setw(12) << std::setprecision(1) << megabytes_per_second << std::endl;
+    }
+
+    fs::remove_all(work_dir);
+    return 0;
+}
+
+/// <summary>
+/// 64-bit FNV-1a hash, continued from a previous value so it can be built up chunk by chunk
+/// </summary>
+uint64_t fnv1a_64(const char* data, size_t length, uint64_t hash = 14695981039346656037ull)
+{
+    for (size_t i = 0; i < length; ++i)
+    {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+/// <summary>
+/// flush a stream and force its contents to stable storage
+/// </summary>
+bool sync_file(std::FILE* file)
+{
+    if (std::fflush(file) != 0)
+    {
+        return false;
+    }
+#if defined(_WIN32)
+    return _commit(_fileno(file)) == 0;
+#elif defined(__linux__)
+    // file size changes are covered by fdatasync, so the timestamp-only metadata write is skipped
+    return fdatasync(fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+/// <summary>
+/// seek with a 64-bit offset; plain fseek takes a long, which is 32 bits on Windows
+/// </summary>
+bool seek_file(std::FILE* file, uint64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(file, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+    return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+}
+
+/// <summary>
+/// progress record written to the checkpoint journal of a streaming job
+/// </summary>
+struct stream_checkpoint
+{
+    uint64_t magic;          // identifies a journal written by this program
+    uint64_t job_id;         // hash of the job arguments, so a journal only resumes the same job
+    uint64_t sequence;       // increases with every checkpoint; the newest valid slot wins
+    uint64_t input_offset;   // bytes of input consumed
+    uint64_t output_offset;  // bytes of output durably written
+    uint64_t key_phase;      // key index the next byte is transformed with
+    uint64_t checksum;       // FNV-1a of the output written so far
+    uint64_t input_size;     // size and modification time of the input when the job started, so a
+    uint64_t input_mtime;    // journal is not resumed against an input that has changed since
+    uint64_t record_checksum; // FNV-1a of the fields above, detects a torn record write
+};
+
+const uint64_t checkpoint_magic = 0x4d35434b50543032ull; // "M5CKPT02"
+
+uint64_t checkpoint_record_checksum(const stream_checkpoint& checkpoint)
+{
+    return fnv1a_64(reinterpret_cast<const char*>(&checkpoint), offsetof(stream_checkpoint, record_checksum));
+}
+
+/// <summary>
+/// the journal holds two fixed slots that are overwritten alternately, so it never grows and a
+/// crash in the middle of a write still leaves the previous checkpoint intact
+/// </summary>
+bool write_checkpoint(std::FILE* journal, stream_checkpoint checkpoint)
+{
+    checkpoint.record_checksum = checkpoint_record_checksum(checkpoint);
+    const uint64_t slot = checkpoint.sequence % 2;
+    return seek_file(journal, slot * sizeof(stream_checkpoint))
+        && std::fwrite(&checkpoint, sizeof(checkpoint), 1, journal) == 1
+        && sync_file(journal);
+}
+
+/// <summary>
+/// load the newest intact checkpoint for this job, if the journal has one
+/// </summary>
+std::optional<stream_checkpoint> read_checkpoint(const std::string& journal_name, uint64_t job_id)
+{
+    std::ifstream journal(journal_name, std::ios::binary);
+    std::optional<stream_checkpoint> newest;
+
+    stream_checkpoint slot;
+    while (journal.read(reinterpret_cast<char*>(&slot), sizeof(slot)))
+    {
+        const bool valid = slot.magic == checkpoint_magic && slot.job_id == job_id
+            && slot.record_checksum == checkpoint_record_checksum(slot);
+        if (valid && (!newest || slot.sequence > newest->sequence))
+        {
+            newest = slot;
+        }
+    }
+    return newest;
+}
+
+/// <summary>
+/// encrypt or decrypt a file of any size in fixed chunks, checkpointing progress to a journal so an
+/// interrupted run restarted with the same arguments resumes from the last durable checkpoint
+/// </summary>
+/// <param name="input_name">file to read</param>
+/// <param name="output_name">file to write; its journal is kept next to it with a .journal suffix</param>
+/// <param name="key">key to use in encryption / decryption</param>
+/// <param name="checkpoint_interval">bytes processed between checkpoints</param>
+/// <returns>true when the whole input has been transformed</returns>
+bool encrypt_stream(const std::string& input_name, const std::string& output_name, const std::string& key, uint64_t checkpoint_interval)
 {
+    const std::string journal_name = output_name + ".journal";
+    const size_t chunk_size = 1024 * 1024;
+
+    // the job is identified by its arguments so a stale journal from a different job is ignored
+    uint64_t job_id = fnv1a_64(input_name.data(), input_name.size());
+    job_id = fnv1a_64(output_name.data(), output_name.size(), job_id);
+    job_id = fnv1a_64(key.data(), key.size(), job_id);
+
+    // the arguments do not say whether the input itself changed, so its size and mtime are recorded too
+    std::error_code error;
+    const uint64_t input_size = std::filesystem::file_size(input_name, error);
+    const uint64_t input_mtime = error ? 0 : static_cast<uint64_t>(std::filesystem::last_write_time(input_name, error).time_since_epoch().count());
+
+    stream_checkpoint progress = { checkpoint_magic, job_id, 0, 0, 0, 0, 14695981039346656037ull, input_size, input_mtime, 0 };
+
+    // only resume against the same input, and if the output still holds everything the checkpoint says was written
+    const std::optional<stream_checkpoint> resumed = read_checkpoint(journal_name, job_id);
+    const bool same_input = resumed && !error && resumed->input_size == input_size && resumed->input_mtime == input_mtime;
+    if (resumed && !same_input)
+    {
+        std::cout << "Input " << input_name << " changed since the checkpoint; starting over" << std::endl;
+    }
+    const bool can_resume = same_input && std::filesystem::file_size(output_name, error) >= resumed->output_offset && !error;
+    if (can_resume)
+    {
+        progress = *resumed;
+        std::filesystem::resize_file(output_name, progress.output_offset);
+        std::cout << "Resuming from checkpoint at byte " << progress.input_offset << std::endl;
+    }
+
+    std::FILE* input = std::fopen(input_name.c_str(), "rb");
+    std::FILE* output = std::fopen(output_name.c_str(), can_resume ? "r+b" : "wb");
+    std::FILE* journal = std::fopen(journal_name.c_str(), can_resume ? "r+b" : "w+b");
+    bool succeeded = input != nullptr && output != nullptr && journal != nullptr
+        && seek_file(input, progress.input_offset) && seek_file(output, progress.output_offset);
+
+    if (!succeeded)
+    {
+        std::cout << "Unable to open stream files" << std::endl;
+    }
+
+    std::vector<char> buffer(chunk_size);
+    uint64_t next_checkpoint = progress.input_offset + checkpoint_interval;
+    while (succeeded)
+    {
+        const size_t bytes_read = std::fread(buffer.data(), 1, buffer.size(), input);
+        if (bytes_read == 0)
+        {
+            succeeded = !std::ferror(input);
+            break;
+        }
+
+        encrypt_decrypt_block(buffer.data(), bytes_read, key, progress.key_phase);
+        if (std::fwrite(buffer.data(), 1, bytes_read, output) != bytes_read)
+        {
+            succeeded = false;
+            break;
+        }
+
+        progress.input_offset += bytes_read;
+        progress.output_offset += bytes_read;
+        progress.key_phase = (progress.key_phase + bytes_read) % key.length();
+        progress.checksum = fnv1a_64(buffer.data(), bytes_read, progress.checksum);
+
+        // checkpoints are batched by bytes: the output must be durable before the journal points past it
+        if (progress.input_offset >= next_checkpoint)
+        {
+            ++progress.sequence;
+            succeeded = sync_file(output) && write_checkpoint(journal, progress);
+            next_checkpoint = progress.input_offset + checkpoint_interval;
+        }
+    }
+
+    if (succeeded)
+    {
+        succeeded = sync_file(output);
+    }
+
+    for (std::FILE* file : { input, output, journal })
+    {
+        if (file != nullptr)
+        {
+            std::fclose(file);
+        }
+    }
+
+    if (!succeeded)
+    {
+        std::cout << "Stream encryption stopped at byte " << progress.input_offset << "; rerun to resume" << std::endl;
+        return false;
+    }
+
+    // the job is complete, so there is nothing left to resume
+    std::filesystem::remove(journal_name, error);
+    std::cout << "Transformed " << progress.output_offset << " bytes, checksum " << std::hex << progress.checksum << std::dec << std::endl;
+    return true;
+}
+
+/// <summary>
+/// bounded lock-free queue for exactly one producer thread and one consumer thread
+/// </summary>
+/// <typeparam name="T">trivially copyable element, such as an index into a chunk pool</typeparam>
+template <typename T>
+class spsc_ring
+{
+public:
+    // one slot always stays empty so that a full ring can be told apart from an empty one
+    explicit spsc_ring(size_t capacity) : slots(capacity + 1) {}
+
+    spsc_ring(const spsc_ring&) = delete;
+    spsc_ring& operator=(const spsc_ring&) = delete;
+
+    bool try_push(const T& value)
+    {
+        const size_t tail_index = tail.load(std::memory_order_relaxed);
+        const size_t next = advance(tail_index);
+        if (next == cached_head)
+        {
+            // only reload the consumer's index when the cached copy says the ring is full
+            cached_head = head.load(std::memory_order_acquire);
+            if (next == cached_head)
+            {
+                return false;
+            }
+        }
+        slots[tail_index] = value;
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& value)
+    {
+        const size_t head_index = head.load(std::memory_order_relaxed);
+        if (head_index == cached_tail)
+        {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (head_index == cached_tail)
+            {
+                return false;
+            }
+        }
+        value = slots[head_index];
+        head.store(advance(head_index), std::memory_order_release);
+        return true;
+    }
+
+    /// <summary>
+    /// push, waiting while the ring is full; this is the back-pressure on a faster producer
+    /// </summary>
+    void push(const T& value)
+    {
+        for (unsigned spins = 0; !try_push(value); ++spins)
+        {
+            back_off(spins);
+        }
+    }
+
+    T pop()
+    {
+        T value;
+        for (unsigned spins = 0; !try_pop(value); ++spins)
+        {
+            back_off(spins);
+        }
+        return value;
+    }
+
+private:
+    size_t advance(size_t index) const { return index + 1 == slots.size() ? 0 : index + 1; }
+
+    static void back_off(unsigned spins)
+    {
+        // spin briefly for low latency, then give the core to the stage we are waiting on
+        if (spins > 64)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    std::vector<T> slots;
+
+    // producer and consumer indices live on separate cache lines, each next to the other side's cached copy
+    alignas(64) std::atomic<size_t> head{ 0 };
+    size_t cached_tail = 0;
+    alignas(64) std::atomic<size_t> tail{ 0 };
+    size_t cached_head = 0;
+};
+
+/// <summary>
+/// tuning for the three-stage pipeline
+/// </summary>
+struct pipeline_options
+{
+    size_t queue_depth = 8;           // chunks in flight between the stages
+    size_t chunk_size = 1024 * 1024;  // bytes per chunk
+};
+
+/// <summary>
+/// encrypt or decrypt a file with separate reader, transformer and writer threads connected by
+/// lock-free rings of preallocated chunks, so each stage runs at its own speed
+/// </summary>
+/// <param name="input_name">file to read</param>
+/// <param name="output_name">file to create with the transformed contents</param>
+/// <param name="key">key to use in encryption / decryption</param>
+/// <param name="options">queue depth and chunk size</param>
+/// <returns>true when the whole input has been transformed and written</returns>
+bool encrypt_pipeline(const std::string& input_name, const std::string& output_name, const std::string& key, const pipeline_options& options)
+{
+    assert(options.queue_depth > 0 && options.chunk_size > 0);
+
+    std::FILE* input = std::fopen(input_name.c_str(), "rb");
+    std::FILE* output = std::fopen(output_name.c_str(), "wb");
+    if (input == nullptr || output == nullptr)
+    {
+        std::cout << "Unable to open pipeline files" << std::endl;
+        for (std::FILE* file : { input, output })
+        {
+            if (file != nullptr)
+            {
+                std::fclose(file);
+            }
+        }
+        return false;
+    }
+
+    // every buffer is allocated up front; only chunk indices travel through the rings
+    struct chunk
+    {
+        std::vector<char> data;
+        size_t size = 0;   // zero marks the end of the stream
+        uint64_t phase = 0;
+    };
+    std::vector<chunk> chunks(options.queue_depth);
+    for (auto& c : chunks)
+    {
+        c.data.resize(options.chunk_size);
+    }
+
+    spsc_ring<size_t> free_chunks(options.queue_depth);   // writer -> reader
+    spsc_ring<size_t> read_chunks(options.queue_depth);   // reader -> transformer
+    spsc_ring<size_t> ready_chunks(options.queue_depth);  // transformer -> writer
+    for (size_t i = 0; i < chunks.size(); ++i)
+    {
+        free_chunks.push(i);
+    }
+
+    std::atomic<bool> failed{ false };
+
+    std::thread reader([&] {
+        uint64_t phase = 0;
+        for (;;)
+        {
+            chunk& c = chunks[free_chunks.pop()];
+            c.size = std::fread(c.data.data(), 1, c.data.size(), input);
+            c.phase = phase;
+            phase += c.size;
+            if (c.size == 0 && std::ferror(input))
+            {
+                // only ever set, never cleared, so a write error stored by the writer cannot be overwritten
+                failed = true;
+            }
+            read_chunks.push(static_cast<size_t>(&c - chunks.data()));
+            if (c.size == 0)
+            {
+                return;
+            }
+        }
+    });
+
+    std::thread transformer([&] {
+        for (;;)
+        {
+            const size_t index = read_chunks.pop();
+            chunk& c = chunks[index];
+            encrypt_decrypt_block(c.data.data(), c.size, key, c.phase);
+            ready_chunks.push(index);
+            if (c.size == 0)
+            {
+                return;
+            }
+        }
+    });
+
+    // the writer runs on the calling thread; after a write error it keeps draining so no stage blocks forever
+    for (;;)
+    {
+        const size_t index = ready_chunks.pop();
+        const chunk& c = chunks[index];
+        if (c.size == 0)
+        {
+            break;
+        }
+        if (!failed && std::fwrite(c.data.data(), 1, c.size, output) != c.size)
+        {
+            failed = true;
+        }
+        free_chunks.push(index);
+    }
+
+    reader.join();
+    transformer.join();
+
+    std::fclose(input);
+    if (std::fclose(output) != 0)
+    {
+        failed = true;
+    }
+    return !failed;
+}
+
+/// <summary>
+/// compare the pipeline against each of its stages run alone and against a one-thread loop
+/// </summary>
+int run_pipeline_benchmark(const pipeline_options& options)
+{
+    namespace fs = std::filesystem;
+
+    const size_t file_size = 512ull * 1024 * 1024;
+    const std::string key = "password";
+    const fs::path work_dir = fs::temp_directory_path() / "m5_pipeline_benchmark";
+    fs::create_directories(work_dir);
+    const std::string input_name = (work_dir / "input.bin").string();
+    const std::string output_name = (work_dir / "output.bin").string();
+
+    std::vector<char> buffer(options.chunk_size);
+    for (size_t i = 0; i < buffer.size(); ++i)
+    {
+        buffer[i] = static_cast<char>(i * 31 + 7);
+    }
+    {
+        std::ofstream input(input_name, std::ios::binary);
+        for (size_t written = 0; written < file_size; written += buffer.size())
+        {
+            input.write(buffer.data(), static_cast<std::streamsize>(std::min(buffer.size(), file_size - written)));
+        }
+    }
+
+    const auto gigabytes_per_second = [&](const std::chrono::duration<double>& elapsed) {
+        return file_size / elapsed.count() / 1e9;
+    };
+    const auto time = [](auto&& body) {
+        const auto start = std::chrono::steady_clock::now();
+        body();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+    };
+
+    // each stage on its own, in chunks of the configured size
+    const auto read_time = time([&] {
+        std::FILE* input = std::fopen(input_name.c_str(), "rb");
+        while (std::fread(buffer.data(), 1, buffer.size(), input) > 0) {}
+        std::fclose(input);
+    });
+    const auto transform_time = time([&] {
+        for (size_t done = 0; done < file_size; done += buffer.size())
+        {
+            encrypt_decrypt_block(buffer.data(), buffer.size(), key, done);
+        }
+    });
+    const auto write_time = time([&] {
+        std::FILE* output = std::fopen(output_name.c_str(), "wb");
+        for (size_t done = 0; done < file_size; done += buffer.size())
+        {
+            std::fwrite(buffer.data(), 1, buffer.size(), output);
+        }
+        std::fclose(output);
+    });
+
+    // all three stages one after another on a single thread
+    const auto sequential_time = time([&] {
+        std::FILE* input = std::fopen(input_name.c_str(), "rb");
+        std::FILE* output = std::fopen(output_name.c_str(), "wb");
+        size_t phase = 0;
+        size_t bytes_read;
+        while ((bytes_read = std::fread(buffer.data(), 1, buffer.size(), input)) > 0)
+        {
+            encrypt_decrypt_block(buffer.data(), bytes_read, key, phase);
+            phase += bytes_read;
+            std::fwrite(buffer.data(), 1, bytes_read, output);
+        }
+        std::fclose(input);
+        std::fclose(output);
+    });
+
+    bool succeeded = true;
+    const auto pipeline_time = time([&] { succeeded = encrypt_pipeline(input_name, output_name, key, options); });
+
+    const auto slowest = std::max({ read_time, transform_time, write_time });
+    std::cout << "Pipeline benchmark: " << file_size / (1024 * 1024) << " MiB, queue depth " << options.queue_depth
+        << ", chunk " << options.chunk_size / 1024 << " KiB" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "  read stage alone:      " << gigabytes_per_second(read_time) << " GB/s" << std::endl;
+    std::cout << "  transform stage alone: " << gigabytes_per_second(transform_time) << " GB/s" << std::endl;
+    std::cout << "  write stage alone:     " << gigabytes_per_second(write_time) << " GB/s" << std::endl;
+    std::cout << "  slowest stage bound:   " << gigabytes_per_second(slowest) << " GB/s" << std::endl;
+    std::cout << "  sum of stages bound:   " << gigabytes_per_second(read_time + transform_time + write_time) << " GB/s" << std::endl;
+    std::cout << "  single thread loop:    " << gigabytes_per_second(sequential_time) << " GB/s" << std::endl;
+    std::cout << "  three stage pipeline:  " << gigabytes_per_second(pipeline_time) << " GB/s" << std::endl;
+
+    fs::remove_all(work_dir);
+    return succeeded ? 0 : 1;
+}
+
+/// <summary>
+/// CPUs this process may run on, in the order workers are pinned to them
+/// </summary>
+std::vector<int> available_cpus()
+{
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &set))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+#endif
+    if (cpus.empty())
+    {
+        // no affinity support: pretend every hardware thread is available and skip pinning
+        for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu)
+        {
+            cpus.push_back(static_cast<int>(cpu));
+        }
+    }
+    return cpus;
+}
+
+/// <summary>
+/// bind the calling thread to one CPU so the memory it first touches stays on that CPU's node
+/// </summary>
+bool pin_current_thread(int cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+/// <summary>
+/// run body(worker) on worker_count threads, each pinned to its own CPU when pin is set
+/// </summary>
+template <typename Body>
+void run_workers(size_t worker_count, bool pin, const Body& body)
+{
+    const std::vector<int> cpus = available_cpus();
+    std::vector<std::thread> workers;
+    for (size_t worker = 0; worker < worker_count; ++worker)
+    {
+        workers.emplace_back([&, worker] {
+            if (pin)
+            {
+                pin_current_thread(cpus[worker % cpus.size()]);
+            }
+            body(worker);
+        });
+    }
+    for (auto& thread : workers)
+    {
+        thread.join();
+    }
+}
+
+/// <summary>
+/// buffer split into page-aligned regions, one per worker; each region is first touched, and so
+/// placed on a NUMA node, by the pinned worker that later transforms it
+/// </summary>
+class placed_buffer
+{
+public:
+    placed_buffer(size_t size, size_t worker_count)
+        // the allocation leaves the pages untouched, so no page is faulted in by the allocating thread; it starts on a
+        // page boundary so that each region, a whole number of pages long, starts on one too
+        : bytes(static_cast<char*>(::operator new(size, std::align_val_t{ page_size }))), length(size), workers(worker_count)
+    {
+        const size_t per_worker = (size + worker_count - 1) / worker_count;
+        region_size = (per_worker + page_size - 1) / page_size * page_size;
+    }
+
+    char* data() { return bytes.get(); }
+    size_t size() const { return length; }
+    size_t worker_count() const { return workers; }
+
+    size_t region_begin(size_t worker) const { return std::min(length, worker * region_size); }
+    size_t region_end(size_t worker) const { return std::min(length, (worker + 1) * region_size); }
+
+private:
+    static constexpr size_t page_size = 4096;
+
+    struct page_aligned_delete
+    {
+        void operator()(char* pointer) const { ::operator delete(pointer, std::align_val_t{ page_size }); }
+    };
+
+    std::unique_ptr<char, page_aligned_delete> bytes;
+    size_t length;
+    size_t workers;
+    size_t region_size;
+};
+
+/// <summary>
+/// read a file into a placed buffer; every pinned worker reads its own region, so each page is
+/// faulted in on the node of the worker that will transform it
+/// </summary>
+/// <returns>the loaded buffer, or nothing if the file could not be read</returns>
+std::optional<placed_buffer> read_file_placed(const std::string& filename, size_t worker_count)
+{
+    std::error_code error;
+    const uint64_t size = std::filesystem::file_size(filename, error);
+    if (error)
+    {
+        return std::nullopt;
+    }
+
+    placed_buffer buffer(static_cast<size_t>(size), worker_count);
+    std::atomic<bool> failed{ false };
+    run_workers(worker_count, true, [&](size_t worker) {
+        const size_t begin = buffer.region_begin(worker);
+        const size_t end = buffer.region_end(worker);
+        if (begin == end)
+        {
+            return;
+        }
+
+        std::FILE* input = std::fopen(filename.c_str(), "rb");
+        if (input == nullptr || !seek_file(input, begin) || std::fread(buffer.data() + begin, 1, end - begin, input) != end - begin)
+        {
+            failed = true;
+        }
+        if (input != nullptr)
+        {
+            std::fclose(input);
+        }
+    });
+
+    if (failed)
+    {
+        return std::nullopt;
+    }
+    return buffer;
+}
+
+/// <summary>
+/// encrypt or decrypt a placed buffer in place; each worker is pinned where it loaded its region,
+/// so the transform reads and writes node-local memory
+/// </summary>
+void encrypt_decrypt_placed(placed_buffer& buffer, const std::string& key)
+{
+    run_workers(buffer.worker_count(), true, [&](size_t worker) {
+        const size_t begin = buffer.region_begin(worker);
+        const size_t end = buffer.region_end(worker);
+        encrypt_decrypt_block(buffer.data() + begin, end - begin, key, begin);
+    });
+}
+
+/// <summary>
+/// compare the parallel transform over a buffer loaded by one thread with the NUMA-placed version
+/// </summary>
+int run_numa_benchmark(size_t size_mib)
+{
+    namespace fs = std::filesystem;
+
+    const size_t size = size_mib * 1024 * 1024;
+    const size_t worker_count = available_cpus().size();
+    const int passes = 5;
+    const std::string key = "password";
+    const fs::path work_dir = fs::temp_directory_path() / "m5_numa_benchmark";
+    fs::create_directories(work_dir);
+    const std::string input_name = (work_dir / "input.bin").string();
+
+    {
+        std::vector<char> block(1024 * 1024);
+        for (size_t i = 0; i < block.size(); ++i)
+        {
+            block[i] = static_cast<char>(i * 131 + 17);
+        }
+        std::ofstream input(input_name, std::ios::binary);
+        for (size_t written = 0; written < size; written += block.size())
+        {
+            input.write(block.data(), static_cast<std::streamsize>(std::min(block.size(), size - written)));
+        }
+    }
+
+    size_t node_count = 0;
+#ifdef __linux__
+    std::error_code error;
+    for (const auto& entry : fs::directory_iterator("/sys/devices/system/node", error))
+    {
+        const std::string name = entry.path().filename().string();
+        node_count += name.rfind("node", 0) == 0 && name.size() > 4 && std::isdigit(static_cast<unsigned char>(name[4]));
+    }
+#endif
+
+    std::cout << "NUMA placement benchmark: " << size_mib << " MiB, " << worker_count << " workers, "
+        << (node_count > 0 ? std::to_string(node_count) : std::string("unknown")) << " NUMA nodes" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+
+    const auto transform_rate = [&](auto&& transform) {
+        const auto start = std::chrono::steady_clock::now();
+        for (int pass = 0; pass < passes; ++pass)
+        {
+            transform();
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return static_cast<double>(size) * passes / elapsed.count() / 1e9;
+    };
+
+    // before: one thread faults every page in, as read_file does, then unpinned workers transform it
+    {
+        std::string loaded(size, '\0');
+        std::FILE* input = std::fopen(input_name.c_str(), "rb");
+        const bool read_all = input != nullptr && std::fread(loaded.data(), 1, size, input) == size;
+        if (input != nullptr)
+        {
+            std::fclose(input);
+        }
+        if (!read_all)
+        {
+            std::cout << "Unable to read benchmark input" << std::endl;
+            fs::remove_all(work_dir);
+            return 1;
+        }
+
+        const size_t per_worker = (size + worker_count - 1) / worker_count;
+        const double rate = transform_rate([&] {
+            run_workers(worker_count, false, [&](size_t worker) {
+                const size_t begin = std::min(size, worker * per_worker);
+                const size_t end = std::min(size, begin + per_worker);
+                encrypt_decrypt_block(loaded.data() + begin, end - begin, key, begin);
+            });
+        });
+        std::cout << "  single-thread load, unpinned transform: " << rate << " GB/s" << std::endl;
+    }
+
+    // after: pinned workers first-touch their own regions and transform them in place
+    {
+        std::optional<placed_buffer> placed = read_file_placed(input_name, worker_count);
+        if (!placed)
+        {
+            std::cout << "Unable to read benchmark input" << std::endl;
+            fs::remove_all(work_dir);
+            return 1;
+        }
+
+        const double rate = transform_rate([&] { encrypt_decrypt_placed(*placed, key); });
+        std::cout << "  first-touch load, pinned transform:     " << rate << " GB/s" << std::endl;
+    }
+
+    if (node_count < 2)
+    {
+        std::cout << "  single node host: run on a multi-socket machine or under emulated NUMA to see the difference" << std::endl;
+    }
+
+    fs::remove_all(work_dir);
+    return 0;
+}
+
+/// <summary>
+/// hardware counter totals for one measured region
+/// </summary>
+struct counter_values
+{
+    double cycles = 0;
+    double instructions = 0;
+    double cache_misses = 0;
+    double branch_misses = 0;
+};
+
+/// <summary>
+/// cycles, instructions, cache misses and branch misses for the calling thread via perf_event_open;
+/// any counter the kernel or container refuses is simply reported as unavailable
+/// </summary>
+class perf_counters
+{
+public:
+    enum counter { cycles, instructions, cache_misses, branch_misses, counter_count };
+
+    perf_counters()
+    {
+#ifdef __linux__
+        const uint64_t configs[counter_count] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+        };
+        for (int i = 0; i < counter_count; ++i)
+        {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            // time enabled / running let us scale the count if the PMU had to multiplex counters
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+            if (fds[i] < 0 && open_error == 0)
+            {
+                open_error = errno;
+            }
+        }
+#endif
+    }
+
+    ~perf_counters()
+    {
+#ifdef __linux__
+        for (int fd : fds)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+#endif
+    }
+
+    perf_counters(const perf_counters&) = delete;
+    perf_counters& operator=(const perf_counters&) = delete;
+
+    bool available(counter which) const { return fds[which] >= 0; }
+
+    bool any_available() const
+    {
+        return std::any_of(std::begin(fds), std::end(fds), [](int fd) { return fd >= 0; });
+    }
+
+    /// <summary>
+    /// why the first counter could not be opened, for the report
+    /// </summary>
+    std::string unavailable_reason() const
+    {
+#ifdef __linux__
+        if (open_error == EACCES || open_error == EPERM)
+        {
+            return "permission denied (check kernel.perf_event_paranoid or the container seccomp profile)";
+        }
+        if (open_error == ENOENT || open_error == EOPNOTSUPP)
+        {
+            return "no hardware PMU exposed to this host";
+        }
+        return open_error == 0 ? "" : std::strerror(open_error);
+#else
+        return "perf_event_open is only available on Linux";
+#endif
+    }
+
+    void start()
+    {
+#ifdef __linux__
+        for (int fd : fds)
+        {
+            if (fd >= 0)
+            {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    counter_values stop()
+    {
+        double totals[counter_count] = {};
+#ifdef __linux__
+        for (int fd : fds)
+        {
+            if (fd >= 0)
+            {
+                ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            }
+        }
+        for (int i = 0; i < counter_count; ++i)
+        {
+            uint64_t value[3] = {}; // count, time enabled, time running
+            if (fds[i] >= 0 && ::read(fds[i], value, sizeof(value)) == static_cast<ssize_t>(sizeof(value)) && value[2] > 0)
+            {
+                totals[i] = static_cast<double>(value[0]) * value[1] / value[2];
+            }
+        }
+#endif
+        return { totals[cycles], totals[instructions], totals[cache_misses], totals[branch_misses] };
+    }
+
+private:
+    int fds[counter_count] = { -1, -1, -1, -1 };
+    int open_error = 0;
+};
+
+/// <summary>
+/// a transform kernel as seen by the profiler: transform size bytes of the buffer once
+/// </summary>
+struct profiled_kernel
+{
+    std::string name;
+    std::function<void(std::string& buffer, const std::string& key)> run;
+};
+
+/// <summary>
+/// every transform kernel in this program; add new variants here to include them in the report
+/// </summary>
+std::vector<profiled_kernel> transform_kernels()
+{
+    return {
+        { "encrypt_decrypt", [](std::string& buffer, const std::string& key) { buffer = encrypt_decrypt(buffer, key); } },
+        { "encrypt_decrypt_block", [](std::string& buffer, const std::string& key) { encrypt_decrypt_block(buffer.data(), buffer.size(), key, 0); } },
+        { "encrypt_batch (64 B)", [offsets = std::vector<uint32_t>()](std::string& buffer, const std::string& key) mutable {
+            // treat the buffer as packed 64-byte records and transform it in place
+            const size_t record_count = buffer.size() / 64;
+            if (offsets.size() != record_count + 1)
+            {
+                offsets.resize(record_count + 1);
+                for (size_t i = 0; i <= record_count; ++i)
+                {
+                    offsets[i] = static_cast<uint32_t>(i * 64);
+                }
+            }
+            encrypt_batch(buffer.data(), offsets.data(), record_count, { key }, buffer.data());
+        } },
+    };
+}
+
+/// <summary>
+/// opt-in profiling mode: per kernel and buffer size, report time and hardware counters per byte
+/// </summary>
+int run_kernel_profile()
+{
+    const std::string key = "password";
+    const size_t bytes_per_measurement = 256ull * 1024 * 1024;
+    // sizes chosen to sit in L1, L2, L3 and main memory on typical hosts
+    const size_t sizes[] = { 4 * 1024, 32 * 1024, 256 * 1024, 2 * 1024 * 1024, 16 * 1024 * 1024, 128 * 1024 * 1024 };
+
+    perf_counters counters;
+    const bool have_counters = counters.any_available();
+    if (!have_counters)
+    {
+        std::cout << "Hardware counters unavailable: " << counters.unavailable_reason() << std::endl;
+        std::cout << "Reporting wall time only." << std::endl;
+    }
+
+    const auto column = [&](bool available, double value) {
+        std::ostringstream text;
+        text << std::fixed << std::setprecision(3);
+        if (available)
+        {
+            text << value;
+        }
+        else
+        {
+            text << "n/a";
+        }
+        return text.str();
+    };
+
+    std::cout << std::left << std::setw(24) << "kernel" << std::right << std::setw(12) << "bytes" << std::setw(10) << "ns/byte"
+        << std::setw(13) << "cycles/byte" << std::setw(8) << "IPC" << std::setw(16) << "cache miss/KiB" << std::setw(17) << "branch miss/KiB" << std::endl;
+
+    for (const auto& kernel : transform_kernels())
+    {
+        for (size_t size : sizes)
+        {
+            std::string buffer(size, 'x');
+            const size_t repetitions = std::max<size_t>(1, bytes_per_measurement / size);
+
+            // warm the caches and the branch predictors before counting
+            kernel.run(buffer, key);
+
+            const auto start = std::chrono::steady_clock::now();
+            counters.start();
+            for (size_t i = 0; i < repetitions; ++i)
+            {
+                kernel.run(buffer, key);
+            }
+            const counter_values totals = counters.stop();
+            const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+            const double bytes = static_cast<double>(size) * repetitions;
+            const double kibibytes = bytes / 1024;
+            std::cout << std::left << std::setw(24) << kernel.name << std::right << std::setw(12) << size
+                << std::setw(10) << column(true, elapsed.count() / bytes)
+                << std::setw(13) << column(counters.available(perf_counters::cycles), totals.cycles / bytes)
+                << std::setw(8) << column(counters.available(perf_counters::cycles) && counters.available(perf_counters::instructions) && totals.cycles > 0,
+                    totals.cycles > 0 ? totals.instructions / totals.cycles : 0)
+                << std::setw(16) << column(counters.available(perf_counters::cache_misses), totals.cache_misses / kibibytes)
+                << std::setw(17) << column(counters.available(perf_counters::branch_misses), totals.branch_misses / kibibytes) << std::endl;
+        }
+    }
+    return 0;
+}
+
+/// <summary>
+/// compare one encrypt_decrypt call per record with a single encrypt_batch sweep
+/// </summary>
+int run_batch_benchmark(size_t record_count, size_t record_size)
+{
+    const std::string key = "password";
+
+    record_batch records;
+    records.data.reserve(record_count * record_size);
+    records.offsets.reserve(record_count + 1);
+    std::string record(record_size, ' ');
+    for (size_t i = 0; i < record_count; ++i)
+    {
+        for (size_t j = 0; j < record_size; ++j)
+        {
+            record[j] = static_cast<char>('a' + (i + j) % 26);
+        }
+        records.add(record);
+    }
+
+    std::cout << "Batch benchmark: " << record_count << " records of " << record_size << " bytes" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+
+    const auto report = [&](const char* name, const std::chrono::duration<double>& elapsed) {
+        std::cout << "  " << name << record_count / elapsed.count() / 1e6 << " M records/s, "
+            << std::setprecision(2) << records.data.size() / elapsed.count() / 1e9 << " GB/s" << std::setprecision(1) << std::endl;
+    };
+
+    // one call per record, as callers do today
+    std::vector<std::string> individually;
+    individually.reserve(record_count);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < record_count; ++i)
+    {
+        individually.push_back(encrypt_decrypt(std::string(records[i]), key));
+    }
+    report("encrypt_decrypt per record: ", std::chrono::steady_clock::now() - start);
+
+    start = std::chrono::steady_clock::now();
+    const record_batch batched = encrypt_batch(records, { key });
+    report("encrypt_batch:              ", std::chrono::steady_clock::now() - start);
+
+    // both paths must agree record for record
+    for (size_t i = 0; i < record_count; ++i)
+    {
+        if (batched[i] != individually[i])
+        {
+            std::cout << "Batch output differs at record " << i << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/// <summary>
+/// 128-bit content fingerprint of a chunk
+/// </summary>
+struct chunk_fingerprint
+{
+    uint64_t high;
+    uint64_t low;
+
+    bool operator==(const chunk_fingerprint& other) const { return high == other.high && low == other.low; }
+};
+
+struct chunk_fingerprint_hash
+{
+    size_t operator()(const chunk_fingerprint& fingerprint) const { return static_cast<size_t>(fingerprint.low); }
+};
+
+/// <summary>
+/// fingerprint a chunk with two independent 64-bit word-at-a-time hashes; fast, but not collision
+/// resistant against a deliberate attacker, so it must not be fed untrusted data meant to collide
+/// </summary>
+chunk_fingerprint fingerprint_chunk(const char* data, size_t length)
+{
+    const auto rotate = [](uint64_t value, int bits) { return (value << bits) | (value >> (64 - bits)); };
+    const auto finalize = [](uint64_t value) {
+        value ^= value >> 33;
+        value *= 0xff51afd7ed558ccdull;
+        value ^= value >> 33;
+        value *= 0xc4ceb9fe1a85ec53ull;
+        return value ^ (value >> 33);
+    };
+
+    uint64_t high = 0x9e3779b97f4a7c15ull ^ length;
+    uint64_t low = 0xc2b2ae3d27d4eb4full ^ length;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        high = rotate(high ^ (word * 0x87c37b91114253d5ull), 31) * 0x4cf5ad432745937full;
+        low = rotate(low ^ (word * 0x52dce729da3ed7b5ull), 27) * 0x38495ab5ull;
+    }
+
+    uint64_t tail = 0;
+    std::memcpy(&tail, data + i, length - i);
+    high = finalize(high ^ tail);
+    low = finalize(low ^ rotate(tail, 17));
+    return { high, low };
+}
+
+/// <summary>
+/// tables of random values for the gear rolling hash, generated with splitmix64 so every run agrees;
+/// the second table holds the same values shifted left by one for the two-bytes-per-step loop
+/// </summary>
+struct gear_tables
+{
+    std::array<uint64_t, 256> gear;
+    std::array<uint64_t, 256> shifted;
+};
+
+const gear_tables& gear_table()
+{
+    static const gear_tables tables = [] {
+        gear_tables values{};
+        uint64_t state = 0x5eed5eed5eed5eedull;
+        for (size_t i = 0; i < 256; ++i)
+        {
+            state += 0x9e3779b97f4a7c15ull;
+            uint64_t mixed = state;
+            mixed = (mixed ^ (mixed >> 30)) * 0xbf58476d1ce4e5b9ull;
+            mixed = (mixed ^ (mixed >> 27)) * 0x94d049bb133111ebull;
+            values.gear[i] = mixed ^ (mixed >> 31);
+            values.shifted[i] = values.gear[i] << 1;
+        }
+        return values;
+    }();
+    return tables;
+}
+
+const size_t min_chunk_size = 2 * 1024;
+const size_t average_chunk_size = 8 * 1024;
+const size_t max_chunk_size = 64 * 1024;
+
+/// <summary>
+/// scan [begin, end) for a position where the gear hash has every bit of mask clear; returns the
+/// chunk length ending there, or zero if there is none
+/// </summary>
+/// <remarks>
+/// two bytes are rolled per step: (hash &lt;&lt; 2) + (gear[a] &lt;&lt; 1) is the hash after byte a shifted left
+/// by one, so it is tested against mask &lt;&lt; 1, and adding gear[b] gives the hash after byte b. This is
+/// exact because mask never uses bit 63.
+/// </remarks>
+size_t find_gear_boundary(const unsigned char* bytes, size_t begin, size_t end, uint64_t mask, uint64_t& hash)
+{
+    const gear_tables& tables = gear_table();
+    const uint64_t shifted_mask = mask << 1;
+    size_t i = begin;
+    for (; i + 2 <= end; i += 2)
+    {
+        hash = (hash << 2) + tables.shifted[bytes[i]];
+        if ((hash & shifted_mask) == 0)
+        {
+            hash >>= 1;
+            return i + 1;
+        }
+        hash += tables.gear[bytes[i + 1]];
+        if ((hash & mask) == 0)
+        {
+            return i + 2;
+        }
+    }
+    if (i < end)
+    {
+        hash = (hash << 1) + tables.gear[bytes[i]];
+        if ((hash & mask) == 0)
+        {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+/// <summary>
+/// content-defined chunking with a gear rolling hash (FastCDC style): returns the length of the next
+/// chunk. Boundaries depend only on nearby content, so an insertion only changes the chunks around it.
+/// </summary>
+size_t next_chunk_length(const char* data, size_t length)
+{
+    if (length <= min_chunk_size)
+    {
+        return length;
+    }
+
+    // a stricter mask before the average size and a looser one after it keeps chunk sizes close to average
+    const uint64_t strict_mask = 0x7fff000000000000ull; // 15 bits
+    const uint64_t loose_mask = 0x7ff0000000000000ull;  // 11 bits
+    const auto* bytes = reinterpret_cast<const unsigned char*>(data);
+    const size_t normal = std::min(average_chunk_size, length);
+    const size_t limit = std::min(max_chunk_size, length);
+
+    // nothing below the minimum can be a boundary, so hashing starts there
+    uint64_t hash = 0;
+    size_t boundary = find_gear_boundary(bytes, min_chunk_size, normal, strict_mask, hash);
+    if (boundary == 0)
+    {
+        boundary = find_gear_boundary(bytes, normal, limit, loose_mask, hash);
+    }
+    return boundary == 0 ? limit : boundary;
+}
+
+/// <summary>
+/// totals for one or more ingested files
+/// </summary>
+struct dedup_stats
+{
+    uint64_t bytes_in = 0;
+    uint64_t bytes_stored = 0;
+    uint64_t chunks = 0;
+    uint64_t new_chunks = 0;
+};
+
+/// <summary>
+/// deduplicating encrypted store: files are split into content-defined chunks, only chunks not seen
+/// before are encrypted and appended to the store, and each file is kept as a recipe of fingerprints
+/// </summary>
+/// <remarks>
+/// layout of the store directory:
+///   chunks.dat       encrypted chunk bytes, appended
+///   chunks.idx       fingerprint, offset and length of each stored chunk, appended
+///   name.recipe      file size followed by the fingerprints of its chunks in order; bytes of the name
+///                    other than letters, digits, '.', '-' and '_' are written as %XX, so every name,
+///                    including a path such as a/data.txt, gets its own recipe file inside the directory
+/// chunk bytes are flushed before the index records that point at them, so after a crash the index
+/// can only lag behind the chunk file; opening the store drops any index records the chunk file does
+/// not cover, and new chunks always go at the real end of the chunk file
+/// </remarks>
+class dedup_store
+{
+public:
+    dedup_store(const std::string& directory, const std::string& key) : directory(directory), key(key)
+    {
+        assert(!key.empty());
+        std::filesystem::create_directories(directory);
+
+        // a missing chunk file is an empty one
+        std::error_code error;
+        const uint64_t chunk_bytes = std::filesystem::file_size(chunks_path(), error);
+        store_size = error ? 0 : chunk_bytes;
+
+        // rebuild the in-memory index from the index file, up to the first record that is torn or points past
+        // the end of the chunk file, and cut the index file back to match
+        uint64_t valid_bytes = 0;
+        {
+            std::ifstream index_file(index_path(), std::ios::binary);
+            index_record record;
+            while (index_file.read(reinterpret_cast<char*>(&record), sizeof(record)) && record.offset + record.length <= store_size)
+            {
+                index.emplace(record.fingerprint, location{ record.offset, record.length });
+                valid_bytes += sizeof(record);
+            }
+        }
+        const uint64_t index_bytes = std::filesystem::file_size(index_path(), error);
+        if (!error && index_bytes != valid_bytes)
+        {
+            std::filesystem::resize_file(index_path(), valid_bytes, error);
+        }
+
+        chunk_file.open(chunks_path(), std::ios::binary | std::ios::app);
+        index_out.open(index_path(), std::ios::binary | std::ios::app);
+    }
+
+    /// <summary>
+    /// add a file to the store under the given name
+    /// </summary>
+    /// <returns>what was added, or nothing if writing the store failed; the file is then not in the store</returns>
+    std::optional<dedup_stats> ingest(const std::string& name, const std::string& data)
+    {
+        dedup_stats stats;
+        stats.bytes_in = data.size();
+
+        const uint64_t file_size = data.size();
+        std::vector<chunk_fingerprint> recipe;
+        std::vector<index_record> new_records;
+        std::vector<char> encrypted;
+        for (size_t offset = 0; offset < data.size();)
+        {
+            const size_t length = next_chunk_length(data.data() + offset, data.size() - offset);
+            const chunk_fingerprint fingerprint = fingerprint_chunk(data.data() + offset, length);
+            recipe.push_back(fingerprint);
+            ++stats.chunks;
+
+            if (index.find(fingerprint) == index.end())
+            {
+                // every chunk is encrypted on its own from key phase zero, so it decrypts without its neighbours
+                encrypted.assign(data.begin() + offset, data.begin() + offset + length);
+                encrypt_decrypt_block(encrypted.data(), length, key, 0);
+                chunk_file.write(encrypted.data(), static_cast<std::streamsize>(length));
+
+                new_records.push_back({ fingerprint, store_size, length });
+                index.emplace(fingerprint, location{ store_size, length });
+                store_size += length;
+
+                stats.bytes_stored += length;
+                ++stats.new_chunks;
+            }
+            offset += length;
+        }
+
+        // the chunks go to disk before the index records that name them, and both before the recipe
+        if (!chunk_file.flush())
+        {
+            return abandon_ingest(new_records);
+        }
+        index_out.write(reinterpret_cast<const char*>(new_records.data()), static_cast<std::streamsize>(new_records.size() * sizeof(index_record)));
+        if (!index_out.flush())
+        {
+            return abandon_ingest(new_records);
+        }
+
+        std::ofstream recipe_file(recipe_path(name), std::ios::binary | std::ios::trunc);
+        recipe_file.write(reinterpret_cast<const char*>(&file_size), sizeof(file_size));
+        recipe_file.write(reinterpret_cast<const char*>(recipe.data()), static_cast<std::streamsize>(recipe.size() * sizeof(chunk_fingerprint)));
+        if (!recipe_file.flush())
+        {
+            recipe_file.close();
+            std::error_code error;
+            std::filesystem::remove(recipe_path(name), error);
+            return std::nullopt;
+        }
+        return stats;
+    }
+
+    /// <summary>
+    /// reassemble and decrypt a stored file; returns nothing if it is not in the store
+    /// </summary>
+    std::optional<std::string> restore(const std::string& name)
+    {
+        std::ifstream recipe_file(recipe_path(name), std::ios::binary);
+        uint64_t file_size = 0;
+        if (!recipe_file.read(reinterpret_cast<char*>(&file_size), sizeof(file_size)))
+        {
+            return std::nullopt;
+        }
+
+        chunk_file.flush();
+        std::ifstream chunks(chunks_path(), std::ios::binary);
+        std::string data;
+        data.reserve(static_cast<size_t>(file_size));
+
+        chunk_fingerprint fingerprint;
+        std::vector<char> chunk;
+        while (recipe_file.read(reinterpret_cast<char*>(&fingerprint), sizeof(fingerprint)))
+        {
+            const auto found = index.find(fingerprint);
+            if (found == index.end())
+            {
+                return std::nullopt;
+            }
+            chunk.resize(static_cast<size_t>(found->second.length));
+            chunks.seekg(static_cast<std::streamoff>(found->second.offset));
+            if (!chunks.read(chunk.data(), static_cast<std::streamsize>(chunk.size())))
+            {
+                return std::nullopt;
+            }
+            encrypt_decrypt_block(chunk.data(), chunk.size(), key, 0);
+            if (fingerprint_chunk(chunk.data(), chunk.size()) != fingerprint)
+            {
+                // the chunk file does not hold what the index says it does
+                return std::nullopt;
+            }
+            data.append(chunk.data(), chunk.size());
+        }
+
+        if (data.size() != file_size)
+        {
+            return std::nullopt;
+        }
+        return data;
+    }
+
+    size_t unique_chunks() const { return index.size(); }
+
+private:
+    struct location
+    {
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    struct index_record
+    {
+        chunk_fingerprint fingerprint;
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    /// <summary>
+    /// forget the chunks of an ingest that could not be written, and carry on from wherever the chunk
+    /// file really ends; any index records that did reach the disk are dropped when the store is next opened
+    /// if they point past the chunk file, and are harmless otherwise
+    /// </summary>
+    std::optional<dedup_stats> abandon_ingest(const std::vector<index_record>& new_records)
+    {
+        for (const auto& record : new_records)
+        {
+            index.erase(record.fingerprint);
+        }
+        chunk_file.clear();
+        index_out.clear();
+        std::error_code error;
+        const uint64_t size = std::filesystem::file_size(chunks_path(), error);
+        store_size = error ? store_size : size;
+        return std::nullopt;
+    }
+
+    std::string chunks_path() const { return (std::filesystem::path(directory) / "chunks.dat").string(); }
+    std::string index_path() const { return (std::filesystem::path(directory) / "chunks.idx").string(); }
+    std::string recipe_path(const std::string& name) const
+    {
+        static const char hex_digits[] = "0123456789ABCDEF";
+        std::string file_name;
+        for (const char c : name)
+        {
+            const unsigned char byte = static_cast<unsigned char>(c);
+            if (std::isalnum(byte) || c == '.' || c == '-' || c == '_')
+            {
+                file_name += c;
+            }
+            else
+            {
+                file_name += '%';
+                file_name += hex_digits[byte >> 4];
+                file_name += hex_digits[byte & 0xF];
+            }
+        }
+        return (std::filesystem::path(directory) / (file_name + ".recipe")).string();
+    }
+
+    std::string directory;
+    std::string key;
+    std::unordered_map<chunk_fingerprint, location, chunk_fingerprint_hash> index;
+    uint64_t store_size = 0;
+    std::ofstream chunk_file;
+    std::ofstream index_out;
+};
+
+/// <summary>
+/// read a whole file byte for byte; unlike read_file it keeps the exact bytes, which the store needs
+/// </summary>
+std::optional<std::string> read_binary_file(const std::string& filename)
+{
+    std::ifstream input(filename, std::ios::binary);
+    if (!input.is_open())
+    {
+        return std::nullopt;
+    }
+    std::ostringstream contents;
+    contents << input.rdbuf();
+    return contents.str();
+}
+
+/// <summary>
+/// ingest the given files into a dedup store and report how much of the input was new; each file is
+/// stored under its path as given, so files with the same name in different directories stay apart
+/// </summary>
+int run_dedup_ingest(const std::string& directory, const std::string& key, const std::vector<std::string>& files)
+{
+    dedup_store store(directory, key);
+    dedup_stats total;
+    for (const auto& file : files)
+    {
+        const std::optional<std::string> data = read_binary_file(file);
+        if (!data)
+        {
+            std::cout << "Unable to open input file " << file << std::endl;
+            return 1;
+        }
+
+        const std::optional<dedup_stats> ingested = store.ingest(std::filesystem::path(file).lexically_normal().generic_string(), *data);
+        if (!ingested)
+        {
+            std::cout << "Unable to write " << file << " to the store in " << directory << std::endl;
+            return 1;
+        }
+        const dedup_stats& stats = *ingested;
+        total.bytes_in += stats.bytes_in;
+        total.bytes_stored += stats.bytes_stored;
+        total.chunks += stats.chunks;
+        total.new_chunks += stats.new_chunks;
+    }
+
+    std::cout << "Ingested " << files.size() << " files, " << total.bytes_in << " bytes in " << total.chunks << " chunks; stored "
+        << total.bytes_stored << " new bytes in " << total.new_chunks << " chunks" << std::endl;
+    return 0;
+}
+
+/// <summary>
+/// build a redundant corpus from inputdatafile.txt-style paragraphs, then measure chunking speed,
+/// ingest speed and how much the store actually writes
+/// </summary>
+int run_dedup_benchmark(size_t file_count)
+{
+    namespace fs = std::filesystem;
+
+    const std::string key = "password";
+    const fs::path work_dir = fs::temp_directory_path() / "m5_dedup_benchmark";
+    fs::remove_all(work_dir);
+
+    // a pool of pseudo-random paragraphs; each file strings together paragraphs drawn from the pool
+    uint64_t state = 42;
+    const auto next_random = [&state] {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        return static_cast<size_t>(state >> 33);
+    };
+    const char* words[] = { "Fire", "in", "the", "hole", "bowsprit", "Jack", "Tar", "gally", "holystone", "sloop", "grog",
+        "heave", "to", "grapple", "Sea", "Legs", "hearties", "case", "shot", "crimp", "spirits", "pillage", "galleon", "chase" };
+    std::vector<std::string> paragraphs(128);
+    for (auto& paragraph : paragraphs)
+    {
+        const size_t target = 32 * 1024 + next_random() % (64 * 1024);
+        while (paragraph.size() < target)
+        {
+            paragraph += words[next_random() % std::size(words)];
+            paragraph += next_random() % 12 == 0 ? ".\n" : " ";
+        }
+    }
+
+    std::vector<std::string> corpus(file_count);
+    uint64_t corpus_bytes = 0;
+    for (auto& file : corpus)
+    {
+        while (file.size() < 1024 * 1024)
+        {
+            file += paragraphs[next_random() % paragraphs.size()];
+        }
+        corpus_bytes += file.size();
+    }
+
+    // chunking and fingerprinting alone, no store
+    auto start = std::chrono::steady_clock::now();
+    uint64_t chunk_count = 0;
+    uint64_t checksum = 0;
+    for (const auto& file : corpus)
+    {
+        for (size_t offset = 0; offset < file.size();)
+        {
+            const size_t length = next_chunk_length(file.data() + offset, file.size() - offset);
+            checksum ^= fingerprint_chunk(file.data() + offset, length).low;
+            offset += length;
+            ++chunk_count;
+        }
+    }
+    const std::chrono::duration<double> chunk_time = std::chrono::steady_clock::now() - start;
+
+    dedup_stats total;
+    start = std::chrono::steady_clock::now();
+    {
+        dedup_store store(work_dir.string(), key);
+        for (size_t i = 0; i < corpus.size(); ++i)
+        {
+            const dedup_stats stats = store.ingest("file" + std::to_string(i), corpus[i]).value_or(dedup_stats{});
+            total.bytes_in += stats.bytes_in;
+            total.bytes_stored += stats.bytes_stored;
+            total.new_chunks += stats.new_chunks;
+        }
+    }
+    const std::chrono::duration<double> ingest_time = std::chrono::steady_clock::now() - start;
+
+    // the store must give back exactly what went in
+    dedup_store reopened(work_dir.string(), key);
+    const bool restored = reopened.restore("file0") == corpus[0] && reopened.restore("file" + std::to_string(corpus.size() - 1)) == corpus.back();
+
+    std::cout << "Dedup benchmark: " << corpus.size() << " files, " << corpus_bytes / (1024 * 1024) << " MiB, " << chunk_count
+        << " chunks (average " << corpus_bytes / std::max<uint64_t>(1, chunk_count) << " bytes, checksum " << std::hex << checksum << std::dec << ")" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "  chunk + fingerprint: " << corpus_bytes / chunk_time.count() / 1e9 << " GB/s" << std::endl;
+    std::cout << "  ingest into store:   " << corpus_bytes / ingest_time.count() / 1e9 << " GB/s" << std::endl;
+    std::cout << "  stored " << total.bytes_stored / (1024 * 1024) << " MiB in " << total.new_chunks << " unique chunks, "
+        << static_cast<double>(total.bytes_in) / std::max<uint64_t>(1, total.bytes_stored) << "x reduction" << std::endl;
+    std::cout << "  restore check: " << (restored ? "ok" : "FAILED") << std::endl;
+
+    fs::remove_all(work_dir);
+    return restored ? 0 : 1;
+}
+
+#ifndef _WIN32
+/// <summary>
+/// read until the buffer is full or the input ends; returns the number of bytes read, or -1 on error
+/// </summary>
+ssize_t read_fully(int fd, char* buffer, size_t size)
+{
+    size_t filled = 0;
+    while (filled < size)
+    {
+        const ssize_t result = ::read(fd, buffer + filled, size - filled);
+        if (result == 0)
+        {
+            break;
+        }
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        filled += static_cast<size_t>(result);
+    }
+    return static_cast<ssize_t>(filled);
+}
+
+/// <summary>
+/// write the whole buffer, retrying partial writes
+/// </summary>
+bool write_fully(int fd, const char* buffer, size_t size)
+{
+    while (size > 0)
+    {
+        const ssize_t result = ::write(fd, buffer, size);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        buffer += result;
+        size -= static_cast<size_t>(result);
+    }
+    return true;
+}
+#endif
+
+/// <summary>
+/// Unix filter mode: encrypt or decrypt stdin to stdout in large blocks with the key phase carried
+/// across block boundaries, using constant memory however long the stream is
+/// </summary>
+/// <remarks>
+/// With use_vmsplice, when stdout is a pipe on Linux, blocks are handed to it with vmsplice instead
+/// of being copied. The pipe then references our pages, so a half of the buffer may only be reused
+/// once the reader has consumed it: the buffer is two halves of exactly the pipe's capacity, and
+/// once a whole half has been spliced into a pipe that can only hold one half, the other half has
+/// left the pipe. That is only safe when the reader copies the bytes out with read(). A reader that
+/// splices the pages on to a file or another pipe still holds references to them after they leave
+/// our pipe, and sees them overwritten by later blocks, so the fast path is opt-in.
+/// </remarks>
+int run_filter(const std::string& key, bool use_vmsplice)
+{
+    if (key.empty())
+    {
+        // stdout carries the filtered data, so the message must not go there
+        std::cerr << "Filter mode needs a non-empty key" << std::endl;
+        return 1;
+    }
+
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+
+    std::vector<char> buffer(1024 * 1024);
+    uint64_t phase = 0;
+    size_t bytes_read;
+    while ((bytes_read = std::fread(buffer.data(), 1, buffer.size(), stdin)) > 0)
+    {
+        encrypt_decrypt_block(buffer.data(), bytes_read, key, phase);
+        phase += bytes_read;
+        if (std::fwrite(buffer.data(), 1, bytes_read, stdout) != bytes_read)
+        {
+            return 1;
+        }
+    }
+    return std::ferror(stdin) || std::fflush(stdout) != 0 ? 1 : 0;
+#else
+    size_t block_size = 1024 * 1024;
+
+#ifdef __linux__
+    struct stat output_stat;
+    if (!use_vmsplice || fstat(STDOUT_FILENO, &output_stat) != 0 || !S_ISFIFO(output_stat.st_mode))
+    {
+        use_vmsplice = false;
+    }
+    else
+    {
+        // grow the pipe so each splice moves a large block; the kernel may grant less than asked
+        fcntl(STDOUT_FILENO, F_SETPIPE_SZ, static_cast<int>(block_size));
+        const int pipe_size = fcntl(STDOUT_FILENO, F_GETPIPE_SZ);
+        if (pipe_size > 0)
+        {
+            block_size = static_cast<size_t>(pipe_size);
+        }
+        else
+        {
+            use_vmsplice = false;
+        }
+    }
+#else
+    use_vmsplice = false;
+#endif
+
+    // page aligned so every spliced page belongs to exactly one half
+    const size_t page_size = 4096;
+    std::unique_ptr<char, decltype(&std::free)> buffer(static_cast<char*>(std::aligned_alloc(page_size, 2 * block_size)), &std::free);
+    if (!buffer)
+    {
+        return 1;
+    }
+
+    uint64_t phase = 0;
+    for (size_t half = 0;; half ^= 1)
+    {
+        char* block = buffer.get() + half * block_size;
+        const ssize_t bytes_read = read_fully(STDIN_FILENO, block, block_size);
+        if (bytes_read <= 0)
+        {
+            return bytes_read < 0 ? 1 : 0;
+        }
+
+        const size_t length = static_cast<size_t>(bytes_read);
+        encrypt_decrypt_block(block, length, key, phase);
+        phase += length;
+
+        size_t written = 0;
+#ifdef __linux__
+        while (use_vmsplice && written < length)
+        {
+            iovec vector = { block + written, length - written };
+            const ssize_t result = vmsplice(STDOUT_FILENO, &vector, 1, 0);
+            if (result < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                // not a pipe we can splice into after all; plain writes still work
+                use_vmsplice = false;
+                break;
+            }
+            written += static_cast<size_t>(result);
+        }
+#endif
+        if (!write_fully(STDOUT_FILENO, block + written, length - written))
+        {
+            return 1;
+        }
+
+        // only the final block can be short, so the half-buffer argument above holds until the end
+        if (length < block_size)
+        {
+            return 0;
+        }
+    }
+#endif
+}
+
+int main(int argc, char* argv[])
+{
+    // optional tool and benchmark modes are selected by the first command line argument
+    if (argc > 1)
+    {
+        const std::string mode = argv[1];
+        if (mode == "--filter" && (argc == 3 || (argc == 4 && std::string(argv[3]) == "--vmsplice")))
+        {
+            // --vmsplice: splice blocks into a stdout pipe; only for readers that read() rather than splice onward
+            return run_filter(argv[2], argc == 4);
+        }
+        if (mode == "--bench-async")
+        {
+            return run_async_benchmark();
+        }
+        if (mode == "--encrypt-stream" && argc >= 5)
+        {
+            // optional fifth argument: checkpoint interval in MiB
+            const uint64_t interval_mib = argc > 5 ? std::stoull(argv[5]) : 64;
+            return encrypt_stream(argv[2], argv[3], argv[4], interval_mib * 1024 * 1024) ? 0 : 1;
+        }
+        if (mode == "--encrypt-pipeline" || mode == "--bench-pipeline")
+        {
+            // trailing optional arguments: queue depth, chunk size in KiB
+            const int first_option = mode == "--encrypt-pipeline" ? 5 : 2;
+            pipeline_options options;
+            if (argc > first_option)
+            {
+                options.queue_depth = std::stoul(argv[first_option]);
+            }
+            if (argc > first_option + 1)
+            {
+                options.chunk_size = std::stoul(argv[first_option + 1]) * 1024;
+            }
+
+            if (mode == "--bench-pipeline")
+            {
+                return run_pipeline_benchmark(options);
+            }
+            if (argc >= 5)
+            {
+                return encrypt_pipeline(argv[2], argv[3], argv[4], options) ? 0 : 1;
+            }
+        }
+        if (mode == "--bench-numa")
+        {
+            // optional second argument: buffer size in MiB
+            return run_numa_benchmark(argc > 2 ? std::stoul(argv[2]) : 1024);
+        }
+        if (mode == "--profile-kernels")
+        {
+            return run_kernel_profile();
+        }
+        if (mode == "--bench-batch")
+        {
+            // optional arguments: record count, record size in bytes
+            return run_batch_benchmark(argc > 2 ? std::stoul(argv[2]) : 4000000, argc > 3 ? std::stoul(argv[3]) : 64);
+        }
+        if (mode == "--dedup-ingest" && argc >= 5)
+        {
+            return run_dedup_ingest(argv[2], argv[3], std::vector<std::string>(argv + 4, argv + argc));
+        }
+        if (mode == "--bench-dedup")
+        {
+            // optional second argument: number of 1 MiB files in the corpus
+            return run_dedup_benchmark(argc > 2 ? std::stoul(argv[2]) : 256);
+        }
+
+        std::cout << "Unknown option: " << mode << std::endl;
+        return 1;
+    }
+
     std::cout << "Encyption Decryption Test!" << std::endl;
 
     // input file format